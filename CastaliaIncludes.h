@@ -36,8 +36,12 @@ string par(string);
 #define trace() cout
 #define MAC_LAYER_PACKET 0
 class CCA_result;
+#define CS_NOT_VALID 101
+#define CS_NOT_VALID_YET 100
 class XMacPacket;
 class BMacPacket;
+class VirtualMobilityManager;
+struct NodeLocation_type;
 typedef int simtime_t ;
 class MacawPacket;
 #define CLEAR 0
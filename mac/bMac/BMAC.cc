@@ -37,7 +37,19 @@ void BMAC::startup() {
 	phyDataRate        = par("phyDataRate");
 	phyFrameOverhead   = par("phyFrameOverhead");
 
-	wakeupDelay        = par("wakeupDelay");
+	radioTiming = RadioTiming::create(par("phyRadio").stdstringValue(),
+			phyDataRate, phyFrameOverhead, par("phyTurnaroundTime"),
+			par("wakeupDelay"));
+	wakeupDelay        = radioTiming->getWakeupDelay();
+
+	adaptiveCCA        = par("adaptiveCCA");
+	ccaSamples         = adaptiveCCA ? (int)par("ccaSamples") : 1;
+	ccaSampleInterval  = par("ccaSampleInterval");
+	ccaOutlierMargin   = par("ccaOutlierMargin");
+	ccaThreshold       = par("ccaThreshold");
+	noiseFloor = new NoiseFloor(par("initialNoiseFloor"),
+			par("noiseFloorAlpha"), par("noiseFloorQueueLength"));
+	ccaSamplesLeft = 0;
 
 	/* note: when setting parameters, listenPeriod must be at least twice as
 	 * large as maxAckDelay, so that transmission can be retried while the
@@ -52,22 +64,49 @@ void BMAC::startup() {
 	maxDataSendDelay      = par("maxDataSendDelay");
 	maxBroadcastDataDelay = par("maxBroadcastDataDelay");
 
+	packetTrains          = par("packetTrains");
+	sentMoreData          = false;
+	moreDataExpected      = false;
+
 	useComplexIncrementMethod = par("useComplexIncrementMethod");
 
 	sinkMacAddress        = par("sinkMacAddress");
+	alwaysOn = par("sinkAlwaysOn") && (SELF_MAC_ADDRESS == sinkMacAddress);
 
-	myBackoff = 0;
+	initialBackoffWindow  = par("initialBackoffWindow");
+	maxBackoff            = par("maxBackoff");
 
 	waitForAckTxTime = par("waitForAckTxTime");
 	maxAckDelay = par("maxAckDelay");
 
 	preamblePacketLength = par("preamblePacketLength");
+	modelPreambleAsInterval = par("modelPreambleAsInterval");
+	preambleRange = par("preambleRange");
+	if (modelPreambleAsInterval && (preambleRange <= 0)) {
+		opp_error("BMAC: modelPreambleAsInterval requires preambleRange to "
+				"be set to the radio range of the deployment");
+	}
+	// shared by all nodes, and may still hold preambles from a previous run
+	preambleRegistry.clear();
+	addressedPreambles = par("addressedPreambles");
+	if (addressedPreambles && !modelPreambleAsInterval) {
+		opp_error("BMAC: addressedPreambles requires modelPreambleAsInterval, "
+				"as a preamble packet is only detected, never decoded, on CCA");
+	}
+	dataWakeGuard = par("dataWakeGuard");
 
-	int phyFrameOverhead = par("phyFrameOverhead");
 	gapBetweenPreambleAndData = par("dataGap");
-	preambleTransmissionTime = (phyFrameOverhead+preamblePacketLength)*1/(1000*phyDataRate/8.0);
+	preambleTransmissionTime = radioTiming->getTxTime(preamblePacketLength);
 	checkPeriod = preambleTransmissionTime - wakeupDelay;
 	sendDataTime = preambleTransmissionTime + gapBetweenPreambleAndData;
+	currentPreambleTime = preambleTransmissionTime;
+
+	adaptiveCheckPeriod     = par("adaptiveCheckPeriod");
+	maxCheckLevel           = adaptiveCheckPeriod ? (int)par("maxCheckLevel") : 0;
+	idleChecksBeforeStretch = par("idleChecksBeforeStretch");
+	checkLevel = 0;
+	trafficThisCheck = false;
+	idleChecks = 0;
 
 	trace() << "preamble transmission time: " << preambleTransmissionTime << " seconds.";
 	trace() << "Check period: " << checkPeriod << " seconds.";
@@ -83,6 +122,9 @@ void BMAC::startup() {
 	declareOutput("Number of preamble packets received");  // this is purely for debugging and does not make sense in context of the protocol implementation
 	declareOutput("Number of DATA packets received");      // number that we've received and /are/ addressed to us
 	declareOutput("Number of acks received");
+	declareOutput("Number of listen timeouts");   // i.e. false wakeups
+	declareOutput("Number of preambles overheard");
+	declareOutput("Number of preambles skipped");   // destination always on
 
 	// initialise internal state
 	currentSequenceNumber = 0;
@@ -118,13 +160,20 @@ void BMAC::timerFiredCallback(int timer) {
 	case BMAC_TIMER_RETRY: handleRetryTimerCallback();    break;
 	case BMAC_TIMER_RETRYWAKEUP: handleRetryWakeupTimerCallback();    break;
 	case BMAC_TIMER_WAITFORPREAMBLE: handleWaitForPreambleTimerCallback(); break;
+	case BMAC_TIMER_CCA_SAMPLE: handleCcaSampleTimerCallback(); break;
+	case BMAC_TIMER_WAITFORACKTX: handleWaitForAckTxTimerCallback(); break;
+	case BMAC_TIMER_WAKEFORDATA: handleWakeForDataTimerCallback(); break;
+	case BMAC_TIMER_DIRECTSEND: handleDirectSendTimerCallback(); break;
 	default: printNonFatalError("Unrecognised timer callback");       break;
 	}
 }
 
 void BMAC::handleCheckPeriodTimerCallback() {
 	printInfo("check period timer fired");
+	if (alwaysOn)
+		return;   // we never stop listening, so there is nothing to check
 	if (currentState == BMAC_STATE_SLEEP) {
+		adaptCheckPeriod();
 		wakeUp();
 		setState(BMAC_STATE_WFRADIORSSI);
 		setTimer(BMAC_TIMER_WFRADIO_CCA, wakeupDelay);
@@ -150,29 +199,136 @@ void BMAC::doCCA() {
 	printInfo("Woken up and radio alive: doing clear channel assessment");
 
 	if (currentState == BMAC_STATE_RSSISAMPLE) {
-		// in future we might want to check twice, in case we hit a gap between
-		// preamble packets, but this has shown to be sufficient.
-		if (isChannelClear(radioModule->readRSSI())) {
-			printInfo("Channel is clear. Going back to sleep");
-			setTimer(BMAC_TIMER_CHECKPERIOD, BMAC_CHECK_PERIOD);
-			setState(BMAC_STATE_SLEEP);
-			goToSleep();
-		} else {
-			trace() << "Channel is not clear: must be a preamble!!!";
-			setState(BMAC_STATE_LISTEN);
-			setTimer(BMAC_TIMER_LISTENTIMEOUT, listenPeriod);
-		}
+		ccaSamplesLeft = ccaSamples;
+		handleCcaSampleTimerCallback();
 	} else {
 		printNonFatalError("Attempted RSSI in non-CCA state");
 	}
 }
 
-bool BMAC::isChannelClear(int rssiSample) {
+/*
+ *  Takes one of the ccaSamples signal strength samples of a CCA. A single
+ *  sample showing the channel idle (an outlier below the noise floor) is
+ *  enough to go back to sleep, since the signal stays above the noise floor
+ *  throughout a real preamble. Only if every sample is above the noise floor
+ *  do we stay awake to listen for data.
+ */
+void BMAC::handleCcaSampleTimerCallback() {
+	if (currentState != BMAC_STATE_RSSISAMPLE) {
+		printNonFatalError("CCA sample timer fired outside CCA");
+		return;
+	}
+
+	if (isPreambleInRange()) {
+		handlePreambleDetected();
+		return;
+	}
+
+	double rssi = radioModule->readRSSI();
+	ccaSamplesLeft--;
+	if (isChannelClear(rssi)) {
+		printInfo("Channel is clear. Going back to sleep");
+		if (adaptiveCCA)
+			noiseFloor->addIdleSample(rssi);
+		setTimer(BMAC_TIMER_CHECKPERIOD, BMAC_CHECK_PERIOD);
+		setState(BMAC_STATE_SLEEP);
+		goToSleep();
+	} else if (ccaSamplesLeft > 0) {
+		setTimer(BMAC_TIMER_CCA_SAMPLE, ccaSampleInterval);
+	} else {
+		trace() << "Channel is not clear: must be a preamble!!!";
+		setState(BMAC_STATE_LISTEN);
+		setTimer(BMAC_TIMER_LISTENTIMEOUT, getListenTimeout());
+	}
+}
+
+/*
+ *  Sends the packet at the front of the buffer to an always-on destination,
+ *  without a preamble, if the channel is clear. Otherwise the channel is
+ *  checked again after a short random delay.
+ */
+void BMAC::handleDirectSendTimerCallback() {
+	if (isChannelClear(radioModule->readRSSI()) && !isPreambleInRange()) {
+		printInfo("Destination is always on: sending without a preamble");
+		collectOutput("Number of preambles skipped", SELF_MAC_ADDRESS);
+		setState(BMAC_STATE_PREAMBLE_SEND);
+		handleWaitForPreambleTimerCallback();
+	} else {
+		printInfo("Channel busy: waiting to send to always-on destination");
+		setTimer(BMAC_TIMER_DIRECTSEND,
+				initialBackoffWindow*(rand()/(RAND_MAX + 1.0))/1000);
+	}
+}
+
+/*
+ *  Called when CCA finds a neighbour's preamble in the preamble registry.
+ *  With addressed preambles we know who the data is for and when it will be
+ *  sent: if it is not for us we go straight back to sleep, and if it is we
+ *  sleep until just before it. Otherwise we listen for the data.
+ */
+void BMAC::handlePreambleDetected() {
+	if (!addressedPreambles) {
+		trace() << "Channel is not clear: must be a preamble!!!";
+		setState(BMAC_STATE_LISTEN);
+		setTimer(BMAC_TIMER_LISTENTIMEOUT, getListenTimeout());
+		return;
+	}
+
+	NodeLocation_type location = getLocation();
+	PreambleInterval preamble;
+	if (preambleRegistry.findPreambleFor(SELF_MAC_ADDRESS, location.x,
+			location.y, location.z, preambleRange, simTime(),
+			BROADCAST_MAC_ADDRESS, preamble)) {
+		sleepUntilData(preamble.dataTime);
+	} else {
+		printInfo("Preamble is not for us. Going back to sleep");
+		collectOutput("Number of preambles overheard", SELF_MAC_ADDRESS);
+		goToSleep(false);
+	}
+}
+
+/*
+ *  Sleeps through the rest of a preamble addressed to us, waking up
+ *  dataWakeGuard before the data is due.
+ */
+void BMAC::sleepUntilData(simtime_t dataTime) {
+	setState(BMAC_STATE_WFDATA);
+	double sleepTime = SIMTIME_DBL(dataTime - simTime()) - wakeupDelay
+			- dataWakeGuard;
+	if (sleepTime <= 0) {
+		handleWakeForDataTimerCallback();
+		return;
+	}
+	trace() << "Preamble is for us: sleeping for " << sleepTime << " seconds.";
+	toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+	setTimer(BMAC_TIMER_WAKEFORDATA, sleepTime);
+}
+
+void BMAC::handleWakeForDataTimerCallback() {
+	wakeUp();
+	setState(BMAC_STATE_LISTEN);
+	setTimer(BMAC_TIMER_LISTENTIMEOUT, wakeupDelay + dataWakeGuard + maxDataDelay);
+}
+
+/*
+ *  With adaptiveCCA, a sample shows the channel to be clear if it is an
+ *  outlier below the noise floor estimate; otherwise it is compared with the
+ *  fixed ccaThreshold.
+ */
+bool BMAC::isChannelClear(double rssiSample) {
 	if (printDebuggingInfo)
-		trace() << "Checking channel: " << radioModule->isChannelClear();
+		trace() << "Checking channel: " << rssiSample << " dBm, noise floor " <<
+				noiseFloor->getFloor() << " dBm";
 
-	double staticThreshold = -95.0;  // dBm
-	return (radioModule->readRSSI() > staticThreshold);
+	if (!isValidRSSI(rssiSample)) {
+		printNonFatalError("Not waiting long enough after wakeup for CCA. "
+				"Check wakeupDelay parameter");
+		return false;
+	}
+
+	if (adaptiveCCA)
+		return noiseFloor->isOutlier(rssiSample, ccaOutlierMargin);
+	return (rssiSample < ccaThreshold);
 
 	/*  old reference version:
 	CCA_result ccaResult = radioModule->isChannelClear();
@@ -203,15 +359,18 @@ void BMAC::handleRetryWakeupTimerCallback() {
 void BMAC::handleWfAckTimerCallback() {
 	trace() << "in wfack callback";
 	//assert(!currentPacketIsBroadcast); // method precondition test
-	if (!currentPacketIsBroadcast)		return;
+	if (currentPacketIsBroadcast)		return;
+	int destination = check_and_cast<BMacPacket*>(macBuffer->peek())->getDestination();
 	if (numRetries < BMAC_NUM_RETRIES) {
 		/* we still have retries left: try resending it */
 		printInfo("Increasing backoff ready for retry");
-		setTimer(BMAC_TIMER_RETRY, increaseBackoff());
+		setTimer(BMAC_TIMER_RETRY, increaseBackoff(destination));
 		goToSleep(false);
 	} else {
 		/* we've tried the maximum number of times & it hasn't worked :( */
 		printNonFatalError("No ACK from neighbour. Data possibly not received.");
+		resetBackoff(destination);   // the next packet starts afresh
+		deleteFrontOfBuffer();
 		goToSleep();
 	}
 	return;
@@ -224,6 +383,8 @@ void BMAC::handleListenTimeoutCallback() {
 	 */
 
 	printInfo("Listen timed out: no data packets received");
+	collectOutput("Number of listen timeouts", SELF_MAC_ADDRESS);
+	takeRSSIsample(false);   // the channel was only noisy, so learn from it
 	setTimer(BMAC_TIMER_CHECKPERIOD, checkPeriod);
 	setState(BMAC_STATE_SLEEP);
 	goToSleep();
@@ -267,8 +428,7 @@ void BMAC::printPacketReceived(string description) {
 }
 
 /*
- *  Unimplemented, since noise floor in network is roughly constant, so
- *  software-automatic gain control is unnecessary.
+ *  Updates the noise floor estimate with a sample of the channel.
  *  Must be called when the node is awake and the channel is assumed to be
  *  clear!!!
  */
@@ -277,19 +437,29 @@ void BMAC::takeRSSIsample() {
 }
 
 /*
- *  Unimplemented, since noise floor in network is roughly constant, so
- *  software-automatic gain control is unnecessary.
- *  Must be called when the node is awake!!!
+ *  Updates the noise floor estimate with a sample of the channel.
+ *  Must be called when the node is awake and the channel is assumed to be
+ *  clear!!!
  */
 void BMAC::takeRSSIsample(bool goToSleepAfterSample) {
-	/*
-	 *  This is where software-automatic gain control would be implemented.
-	 */
+	double rssi = radioModule->readRSSI();
+	if (adaptiveCCA && isValidRSSI(rssi) && !isPreambleInRange()) {
+		noiseFloor->addIdleSample(rssi);
+		trace() << "Noise floor estimate: " << noiseFloor->getFloor() << " dBm";
+	}
 
 	if (goToSleepAfterSample)
 		goToSleep();
 }
 
+/*
+ *  The radio returns a special value instead of a signal strength if it has
+ *  not been listening long enough for the reading to be valid.
+ */
+bool BMAC::isValidRSSI(double rssiSample) {
+	return (rssiSample != CS_NOT_VALID) && (rssiSample != CS_NOT_VALID_YET);
+}
+
 /*
  *  Changes to the sleep state, and checks the txbuffer and initiates
  *  transmission if it is non-empty, otherwise turns off the radio.
@@ -319,14 +489,14 @@ void BMAC::goToSleep(bool canCheckTxBuffer) {
 			sendBufferedDataPacket();
 		} else {
 			printInfo("Sending sleep command to radio layer");
-			toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+			toRadioLayer(createRadioCommand(SET_STATE, alwaysOn ? RX : SLEEP));
 			setTimer(BMAC_TIMER_CHECKPERIOD, checkPeriod);
 		}
 	} else {
 		// control flow should never reach here, since the canCheckTxBuffer
 		// variable is not changed after call: included for robustness
 		printInfo("Sending sleep command to radio layer");
-		toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+		toRadioLayer(createRadioCommand(SET_STATE, alwaysOn ? RX : SLEEP));
 	}
 }
 
@@ -350,16 +520,30 @@ void BMAC::sendBufferedDataPacket() {
 	BMacPacket* macPacket = check_and_cast <BMacPacket*>(macBuffer->peek());
 	currentPacketIsBroadcast =
 			(macPacket->getDestination() == BROADCAST_MAC_ADDRESS);
+	currentPreambleTime = getPreambleTimeFor(macPacket->getDestination());
 
 	// this might cause problems, and isn't strictly necessary
 	// (just slightly cleaner), so can be removed if necessary
 	cancelTimer(BMAC_TIMER_CHECKPERIOD);
 
+	/* a destination that is always on doesn't need a preamble: just check
+	 * the channel once the radio is awake, and send the data */
+	if (!currentPacketIsBroadcast && (numRetries == 1)
+			&& alwaysOnNeighbours.count(macPacket->getDestination())) {
+		setState(BMAC_STATE_PRESENDCCA);
+		setTimer(BMAC_TIMER_DIRECTSEND, wakeupDelay);
+		return;
+	}
+
 	/* send preamble to required destination */
 	// NOTE: preamble is sent to broadcast address, to emulate a pseudorandom
 	// bit stream
-	sendPreamble();
-	setTimer(BMAC_TIMER_WAITFORPREAMBLE, sendDataTime);
+	if (modelPreambleAsInterval)
+		startPreamble();
+	else
+		sendPreamble();
+	setTimer(BMAC_TIMER_WAITFORPREAMBLE,
+			currentPreambleTime + gapBetweenPreambleAndData);
 }
 
 /*
@@ -368,6 +552,8 @@ void BMAC::sendBufferedDataPacket() {
  */
 void BMAC::handleWaitForPreambleTimerCallback() {
 	printInfo("Preamble sent. Sending data");
+	if (modelPreambleAsInterval)
+		endPreamble();
 	sendDataFromFrontOfBuffer();
 	setState(BMAC_STATE_WFACK);
 	if (!currentPacketIsBroadcast) {
@@ -393,12 +579,89 @@ void BMAC::sendPreamble() {
 	preamblePacket->setDestination(BROADCAST_MAC_ADDRESS);
 	preamblePacket->setType(BMAC_PACKET_PREAMBLE);
 	preamblePacket->setSequenceNumber(currentSequenceNumber);
-	preamblePacket->setByteLength(preamblePacketLength);
+	preamblePacket->setByteLength(
+			radioTiming->getBytesInTime(currentPreambleTime));
 	printInfo("Sending preamble packet to radio layer");
 	toRadioLayer(preamblePacket);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
 }
 
+/*
+ *  @return True if packet trains are enabled and the packet after the one at
+ *          the front of the buffer is for the given (unicast) destination.
+ */
+bool BMAC::hasMoreDataFor(int destination) {
+	if (!packetTrains || (destination == BROADCAST_MAC_ADDRESS)
+			|| (macBuffer->numPackets() < 2))
+		return false;
+	BMacPacket* nextPacket = check_and_cast<BMacPacket*>(macBuffer->peek(1));
+	return (nextPacket->getDestination() == destination);
+}
+
+/*
+ *  Sends the packet now at the front of the buffer as part of a packet train:
+ *  the destination has just acknowledged the previous packet, which told it
+ *  to stay awake for this one, so no preamble is needed. The data goes out
+ *  dataGap after the ACK, via the same timer as after a preamble.
+ */
+void BMAC::sendNextInTrain() {
+	printInfo("Sending next packet of train");
+	setState(BMAC_STATE_PREAMBLE_SEND);
+	numRetries++;
+	currentPacketIsBroadcast = false;
+	setTimer(BMAC_TIMER_WAITFORPREAMBLE, gapBetweenPreambleAndData);
+}
+
+/*
+ *  Registers the long preamble with the shared preamble registry, in place of
+ *  sending a preamble packet: for the next currentPreambleTime seconds,
+ *  nodes within preambleRange of us will find the channel busy when they do
+ *  clear channel assessment. The radio is left listening, which on the CC2420
+ *  draws about the same power as transmitting.
+ *  As sendPreamble(), this does not handle any state transitions.
+ */
+void BMAC::startPreamble() {
+	collectOutput("Number of preamble packets sent", SELF_MAC_ADDRESS);
+	NodeLocation_type location = getLocation();
+	simtime_t now = simTime();
+	int destination = check_and_cast<BMacPacket*>(macBuffer->peek())->getDestination();
+	preambleRegistry.add(SELF_MAC_ADDRESS, destination, location.x,
+			location.y, location.z, now, now+currentPreambleTime,
+			now+currentPreambleTime+gapBetweenPreambleAndData);
+	printInfo("Registered preamble interval");
+}
+
+/*
+ *  Removes our preamble from the registry. It will normally have expired by
+ *  now anyway, but a preamble may be cut short (e.g. on reset).
+ */
+void BMAC::endPreamble() {
+	preambleRegistry.remove(SELF_MAC_ADDRESS);
+}
+
+/*
+ *  @return True if a neighbour within preambleRange is part way through a
+ *          long preamble (always false unless preambles are modelled as
+ *          intervals).
+ */
+bool BMAC::isPreambleInRange() {
+	if (!modelPreambleAsInterval)
+		return false;
+	NodeLocation_type location = getLocation();
+	return preambleRegistry.isBusy(SELF_MAC_ADDRESS, location.x, location.y,
+			location.z, preambleRange, simTime());
+}
+
+/*
+ *  Location of this node, from its mobility manager.
+ */
+NodeLocation_type BMAC::getLocation() {
+	VirtualMobilityManager* mobilityManager =
+			check_and_cast<VirtualMobilityManager*>(getParentModule()->
+					getParentModule()->getSubmodule("MobilityManager"));
+	return mobilityManager->getLocation();
+}
+
 /*
  *  This sends the data packet immediately. Note this is /not/ the same as
  *  sendBufferedDataPacket(), which is the method that goes through all the
@@ -414,6 +677,8 @@ void BMAC::sendDataFromFrontOfBuffer() {
 	dataPacket->setSource(SELF_MAC_ADDRESS);
 	dataPacket->setType(BMAC_PACKET_DATA);
 	dataPacket->setSequenceNumber(currentSequenceNumber);
+	sentMoreData = hasMoreDataFor(dataPacket->getDestination());
+	dataPacket->setMoreData(sentMoreData);
 
 	// consider making these two lines an inline function or macro
 	printInfo("Sending data packet to radio layer");
@@ -436,11 +701,23 @@ void BMAC::wakeUp() {
  *  cause us to miss a preamble from neighbour whilst resetting.
  */
 void BMAC::reset() {
+	if (modelPreambleAsInterval)
+		endPreamble();
 	goToSleep(false);
 	for (int i=0; i<BMAC_NUMBER_OF_TIMERS; i++)
 		cancelTimer(i);
 }
 
+/*
+ *  Called by the simulator at the end of the run.
+ */
+void BMAC::finishSpecific() {
+	delete radioTiming;
+	radioTiming = NULL;
+	delete noiseFloor;
+	noiseFloor = NULL;
+}
+
 
 void BMAC::setState(int newState) {
 	/* it is always valid to transition to one's own state */
@@ -527,12 +804,15 @@ void BMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 		return;
 	}
 
-	if (currentState == BMAC_STATE_LISTEN) {
+	// an always-on sink is listening even in the SLEEP state
+	if ((currentState == BMAC_STATE_LISTEN)
+			|| (alwaysOn && (currentState == BMAC_STATE_SLEEP))) {
 		cancelTimer(BMAC_TIMER_LISTENTIMEOUT);
 		if (macPacket->getType() == BMAC_PACKET_DATA) {
 			if (forUs) {
 				printInfo("Received a data packet intended for us.");
 				collectOutput("Number of DATA packets received", SELF_MAC_ADDRESS);
+				noteTraffic();
 				toNetworkLayer(decapsulatePacket(macPacket));
 				if (destination == BROADCAST_MAC_ADDRESS) {
 					// don't send an ack!
@@ -543,7 +823,8 @@ void BMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 					return;
 				} else {
 					// this method takes care of going to sleep after sending
-					// the ack
+					// the ack (or of staying awake for the rest of a train)
+					moreDataExpected = macPacket->getMoreData();
 					sendAcknowledgement(source, seqNumber);
 					return;
 				}
@@ -557,7 +838,7 @@ void BMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 		} else if (macPacket->getType() == BMAC_PACKET_PREAMBLE) {
 			/* we possibly missed the data and the remote station has resent
 			 * the preamble. stay awake long enough to hear the data.	 */
-			setTimer(BMAC_TIMER_LISTENTIMEOUT, listenPeriod);
+			setTimer(BMAC_TIMER_LISTENTIMEOUT, getListenTimeout());
 		}
 		else {
 			printNonFatalError("Received entire non-data packet in listen state. Ignoring");
@@ -568,9 +849,20 @@ void BMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			if (forUs) {
 				cancelTimer(BMAC_TIMER_ACKTIMEOUT);
 				trace() << "GOT ACK!!! deleting sent packet from buffer.";
+				resetBackoff(source);
 				collectOutput("Number of acks received", SELF_MAC_ADDRESS);
+				neighbourCheckLevels[source] = macPacket->getCheckLevel();
+				neighbourCheckLevelTimes[source] = simTime();
+				if (macPacket->getAlwaysOn())
+					alwaysOnNeighbours.insert(source);
+				else
+					alwaysOnNeighbours.erase(source);
 				deleteFrontOfBuffer();
-				goToSleep(true);
+				if (sentMoreData && (macBuffer->numPackets() > 0)) {
+					sendNextInTrain();
+				} else {
+					goToSleep(true);
+				}
 
 			} else {
 				printInfo("Overheard an ACK. Ignoring");
@@ -595,6 +887,8 @@ void BMAC::sendAcknowledgement(int source, int seqNumber) {
 	ack->setType(BMAC_PACKET_ACK);
 	ack->setSource(SELF_MAC_ADDRESS);
 	ack->setDestination(destination);
+	ack->setCheckLevel(checkLevel);   // so the sender knows our check period
+	ack->setAlwaysOn(alwaysOn);       // ...or that we don't need a preamble
 	trace() << "Sending acknowledgement to radio layer";
 	toRadioLayer(ack);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
@@ -602,6 +896,13 @@ void BMAC::sendAcknowledgement(int source, int seqNumber) {
 }
 
 void BMAC::handleWaitForAckTxTimerCallback() {
+	if (moreDataExpected) {
+		printInfo("Sender has more data for us: staying awake");
+		moreDataExpected = false;
+		setState(BMAC_STATE_LISTEN);
+		setTimer(BMAC_TIMER_LISTENTIMEOUT, maxDataDelay);
+		return;
+	}
 	trace() << "Given radio layer enough time to send ack. Going to sleep.";
 	setTimer(BMAC_TIMER_CHECKPERIOD, BMAC_CHECK_PERIOD);
 	goToSleep();
@@ -612,62 +913,174 @@ int BMAC::handleRadioControlMessage(cMessage*) {
 	return 0;
 }
 
+/*
+ *  Commands from the routing layer carry information that other MAC
+ *  protocols make use of, but we don't, so they are accepted and ignored.
+ *
+ *  @return 1 if the command was handled; 0 otherwise.
+ */
+int BMAC::handleControlCommand(cMessage* msg) {
+	if (dynamic_cast <MacControlMessage*>(msg) == NULL) {
+		printNonFatalError("Unrecognised control command. Ignoring.");
+		return 0;
+	}
+	return 1;
+}
+
 void BMAC::deleteFrontOfBuffer() {
 	trace() << "Deleting buffered packet";
 	cancelAndDelete(macBuffer->peek());
 	macBuffer->removeFirst();
 	numRetries=0;
 	currentSequenceNumber++;
-	resetBackoff();
 }
 
 /*
- *  Backoff is the time that we wait for after a failed transmission, before we
- *  try again. It varies between 0 and maxBackoff.
- *  Result is returned in seconds, ready to be be passed into the setTimer(..)
- *  function directly.
+ *  Records that we have received data. The check period is shortened
+ *  straight away (to the base check period), so that further data is not
+ *  held up; it is lengthened again gradually once the traffic has stopped.
+ *  Senders learn the new level from our ACKs, and meanwhile use preambles
+ *  that are longer than necessary, which still reach us. As we stretch it
+ *  again without telling them, they allow for as much stretching as could
+ *  have happened since (see getPossibleCheckLevel()).
  */
-inline double BMAC::getCurrentBackoff() const {
-	// The internal myBackoff variable is stored in ms, to make manipulating it
-	// easier. We return it in seconds, since we need it in seconds for any
-	// practical use (e.g. setting a timer).
-	return ((double)bmacBackoffs[myBackoff])/1000;
+void BMAC::noteTraffic() {
+	trafficThisCheck = true;
+	idleChecks = 0;
+	if (checkLevel > 0) {
+		printInfo("Traffic: shortening check period");
+		checkLevel = 0;
+		checkPeriod = getPreambleTime(checkLevel) - wakeupDelay;
+	}
 }
 
 /*
- *  Increases the backoff by some random number of increments (between 1 and 5),
- *  as long as it remains less than the maximum backoff specified in the .ned
- *  file, and returns the new backoff.
+ *  Called on each check, to take account of the traffic since the last one.
+ *  After idleChecksBeforeStretch consecutive checks with no data for us and
+ *  nothing buffered, the check period (and so the preamble needed to reach
+ *  us) is doubled, up to 2^maxCheckLevel times the base check period.
  */
-double BMAC::increaseBackoff() {
-	int maxBackoffArrayPosition = BMAC_NUMBER_OF_BACKOFF_INCREMENTS-1;
-	trace() << "MAX BACKOFF ARRAY POSITION: " << maxBackoffArrayPosition;
-	int rangeToIncreaseBackoff = maxBackoffArrayPosition - myBackoff;
-	trace() << "BACKOFF RANGE: " << rangeToIncreaseBackoff;
-	if (rangeToIncreaseBackoff == 0)
-		return getCurrentBackoff();
+void BMAC::adaptCheckPeriod() {
+	if (trafficThisCheck || (macBuffer->numPackets() > 0)) {
+		idleChecks = 0;
+	} else if ((++idleChecks >= idleChecksBeforeStretch)
+			&& (checkLevel < maxCheckLevel)) {
+		checkLevel++;
+		idleChecks = 0;
+		checkPeriod = getPreambleTime(checkLevel) - wakeupDelay;
+		trace() << "Idle: check level now " << checkLevel << ", check period "
+				<< checkPeriod << " seconds.";
+	}
+	trafficThisCheck = false;
+}
 
-	bool useComplexIncrementMethod = false;
+/*
+ *  @return Length of the preamble needed to reach a node at the given check
+ *          level (seconds).
+ */
+double BMAC::getPreambleTime(int level) {
+	return preambleTransmissionTime*(1 << level);
+}
 
-	if (useComplexIncrementMethod) {
-		int newBackoffArrayPosition = myBackoff+
-				int(rangeToIncreaseBackoff*rand()/(RAND_MAX + 1.0));
-	} else {
-		int newBackoffArrayPosition = myBackoff+1;
-		myBackoff = newBackoffArrayPosition;
+/*
+ *  @return The highest check level that a neighbour which advertised the
+ *          given level at the given time may have reached since. It only
+ *          stretches its check period after idleChecksBeforeStretch idle
+ *          checks at the previous level, the first of which may come as soon
+ *          as it has sent the ACK that advertised the level.
+ */
+int BMAC::getPossibleCheckLevel(int level, simtime_t learnt) {
+	simtime_t elapsed = simTime() - learnt;
+	while (level < maxCheckLevel) {
+		simtime_t stretchTime = (idleChecksBeforeStretch-1)
+				* (getPreambleTime(level) - wakeupDelay);
+		if (elapsed < stretchTime)
+			break;
+		elapsed -= stretchTime;
+		level++;
+	}
+	return level;
+}
+
+/*
+ *  @return Length of the preamble to send to the given destination: long
+ *          enough for its check level, as last advertised in an ACK, allowing
+ *          for any stretching since. The longest preamble is used for
+ *          broadcasts, for neighbours we have no ACK from yet, and for
+ *          retries.
+ */
+double BMAC::getPreambleTimeFor(int destination) {
+	map<int, int>::iterator it = neighbourCheckLevels.find(destination);
+	if ((destination == BROADCAST_MAC_ADDRESS) || (numRetries > 1)
+			|| (it == neighbourCheckLevels.end())) {
+		return getPreambleTime(maxCheckLevel);
 	}
+	return getPreambleTime(getPossibleCheckLevel(it->second,
+			neighbourCheckLevelTimes[destination]));
+}
 
-	trace() << "NEW BACKOFF ARRAY POSITION: " << myBackoff;
-	trace() << "BACKOFF VALUE: " << (getCurrentBackoff()*1000) << "ms.";
-	return getCurrentBackoff();
+/*
+ *  @return Time to listen for data after detecting a preamble, allowing for
+ *          the longest preamble that a sender may use.
+ */
+double BMAC::getListenTimeout() {
+	return listenPeriod + getPreambleTime(maxCheckLevel) - preambleTransmissionTime;
 }
 
-double BMAC::decreaseBackoff() {
-	myBackoff = (myBackoff == 0) ? myBackoff : myBackoff-1;
-	return getCurrentBackoff();
+/*
+ *  Backoff is the time that we wait for after a failed transmission, before we
+ *  try again. Each destination has its own backoff state, so that a sender
+ *  that keeps failing to reach one congested (or sleeping) neighbour does not
+ *  hold up traffic to the others.
+ *
+ *  @return Number of attempts in a row to send to the destination that have
+ *          failed.
+ */
+int BMAC::getBackoffStage(int destination) const {
+	map<int, int>::const_iterator it = backoffStages.find(destination);
+	return (it == backoffStages.end()) ? 0 : it->second;
 }
 
-void BMAC::resetBackoff() {
-	myBackoff = 0;
+/*
+ *  Records a failed attempt to send to the destination, and returns the time
+ *  to back off for before the next one (in seconds, ready to be passed into
+ *  setTimer(..) directly).
+ *  With useComplexIncrementMethod this is randomised binary exponential
+ *  backoff: the backoff is drawn uniformly from a window that starts at
+ *  initialBackoffWindow and doubles with every failure, up to maxBackoff, so
+ *  that two senders that collided at one receiver are unlikely to collide
+ *  again. Otherwise the backoff steps deterministically through the
+ *  bmacBackoffs array.
+ */
+double BMAC::increaseBackoff(int destination) {
+	int stage = getBackoffStage(destination)+1;
+	backoffStages[destination] = stage;
+	double backoff;   // ms
+
+	if (useComplexIncrementMethod) {
+		double window = initialBackoffWindow;
+		for (int i = 1; (i < stage) && (window < maxBackoff); i++)
+			window *= 2;
+		if (window > maxBackoff)
+			window = maxBackoff;
+		backoff = window*rand()/(RAND_MAX + 1.0);
+	} else {
+		int position = stage-1;
+		if (position >= BMAC_NUMBER_OF_BACKOFF_INCREMENTS)
+			position = BMAC_NUMBER_OF_BACKOFF_INCREMENTS-1;
+		backoff = bmacBackoffs[position];
+	}
+
+	trace() << "BACKOFF STAGE FOR " << destination << ": " << stage;
+	trace() << "BACKOFF VALUE: " << backoff << "ms.";
+	return backoff/1000;
+}
+
+/*
+ *  Called when a packet to the destination has been acknowledged, or given up
+ *  on after BMAC_NUM_RETRIES attempts.
+ */
+void BMAC::resetBackoff(int destination) {
+	backoffStages.erase(destination);
 }
 
@@ -12,19 +12,22 @@
 
 #include "VirtualMac.h"
 #include "../macBuffer/MacBuffer.h"
+#include "../macControl/MacControlMessage_m.h"
 #include "BMacPacket_m.h"
+#include "PreambleRegistry.h"
+#include "NoiseFloor.h"
+#include "../radioTiming/RadioTiming.h"
+#include "VirtualMobilityManager.h"
 #include <assert.h>
 #include <string>
+#include <map>
+#include <set>
 #include "../../CastaliaIncludes.h"
 
 using namespace std;
 
 // TODO tidy up all the defines into a column layout
 
-// TODO change this to an inline function
-//#ifndef TX_TIME(x)
-#define TX_TIME(x)		(phyLayerOverhead + x)*1/(1000*phyDataRate/8.0)	//x are in BYTES
-
 /**** defining these two macros was silly (should be in ned file). these parameters are
  * now in fact in the ned file, so delete these macros as soon as possible.          */
 // time we ordinarily listen for
@@ -39,7 +42,7 @@ using namespace std;
 
 // TODO use the last of each of the enum's to signify these
 #define BMAC_NUMBER_OF_STATES 9
-#define BMAC_NUMBER_OF_TIMERS 8
+#define BMAC_NUMBER_OF_TIMERS 11
 #define BMAC_NUMBER_OF_BACKOFF_INCREMENTS 6
 
 /*
@@ -72,7 +75,10 @@ enum BmacTimers {
 	BMAC_TIMER_WFRADIO_CCA,
 	BMAC_TIMER_RETRY,
 	BMAC_TIMER_RETRYWAKEUP,
-	BMAC_TIMER_WAITFORACKTX
+	BMAC_TIMER_WAITFORACKTX,
+	BMAC_TIMER_CCA_SAMPLE,
+	BMAC_TIMER_WAKEFORDATA,
+	BMAC_TIMER_DIRECTSEND
 };
 
 class BMAC : public VirtualMac {
@@ -82,6 +88,7 @@ private:
 	double phyDelayForValidCS;
 	double phyDataRate;
 	int phyFrameOverhead;
+	RadioTiming* radioTiming;   // airtimes, from the above and wakeupDelay
 	double listenPeriod;
 	double checkPeriod;
 	double interAckPeriod;
@@ -94,6 +101,7 @@ private:
 	double preambleTransmissionTime;
 	double gapBetweenPreambleAndData;
 	double sendDataTime;
+	double currentPreambleTime;        // of the preamble being sent
 	double retryPeriod;
 	int sinkMacAddress;
 	double maxAckDelay;
@@ -122,13 +130,24 @@ private:
 	void handleRetryWakeupTimerCallback();
 	void handleWaitForAckTxTimerCallback();
 	void handleWaitForPreambleTimerCallback();
+	void handleCcaSampleTimerCallback();
+	void handleWakeForDataTimerCallback();
+	void handleDirectSendTimerCallback();
 	/* end timer callback functions */
 
 	/* begin cca & rssi functions */
 	double wakeupDelay;
-	bool isChannelClear(int rssiSample);
+	bool isChannelClear(double rssiSample);
+	bool isValidRSSI(double rssiSample);
 	bool canSendData;
 	void doCCA();
+	bool adaptiveCCA;            // from .ned file
+	int ccaSamples;              // from .ned file
+	double ccaSampleInterval;    // from .ned file
+	double ccaOutlierMargin;     // from .ned file
+	double ccaThreshold;         // from .ned file (without adaptiveCCA)
+	int ccaSamplesLeft;
+	NoiseFloor* noiseFloor;
 	void takeRSSIsample();
 	void takeRSSIsample(bool);  // allows the option of not calling the goToSleep() method
 	/* end cca functions */
@@ -138,13 +157,51 @@ private:
 	void sendDataFromFrontOfBuffer();
 	void resendData();
 	int numRetries;
+	bool packetTrains;           // from .ned file
+	bool sentMoreData;           // set on the DATA packet we last sent
+	bool moreDataExpected;       // set on the DATA packet we last received
+	bool hasMoreDataFor(int destination);
+	void sendNextInTrain();
 	/* end sending data functions and state */
 
 	/* begin preamble manipulation functions and state */
 	void sendPreamble();
-	bool useComplexIncrementMethod;
+	bool useComplexIncrementMethod;   // randomised exponential backoff
+	bool modelPreambleAsInterval;    // from .ned file
+	double preambleRange;            // from .ned file
+	static PreambleRegistry preambleRegistry;   // shared by all nodes
+	NodeLocation_type getLocation();
+	void startPreamble();
+	void endPreamble();
+	bool isPreambleInRange();
+	bool addressedPreambles;         // from .ned file
+	double dataWakeGuard;            // from .ned file
+	void handlePreambleDetected();
+	void sleepUntilData(simtime_t dataTime);
 	/* end preamble manipulation functions and state*/
 
+	/* begin traffic-adaptive check period state and functions */
+	bool adaptiveCheckPeriod;    // from .ned file
+	int maxCheckLevel;           // from .ned file
+	int idleChecksBeforeStretch; // from .ned file
+	int checkLevel;              // check period is 2^checkLevel times the base
+	bool trafficThisCheck;
+	int idleChecks;
+	map<int, int> neighbourCheckLevels;   // learnt from their ACKs
+	map<int, simtime_t> neighbourCheckLevelTimes;   // when each was learnt
+	int getPossibleCheckLevel(int level, simtime_t learnt);
+	void noteTraffic();
+	void adaptCheckPeriod();
+	double getPreambleTime(int level);
+	double getPreambleTimeFor(int destination);
+	double getListenTimeout();
+	/* end traffic-adaptive check period state and functions */
+
+	/* begin always-on sink state */
+	bool alwaysOn;                 // we are a sink in sinkAlwaysOn mode
+	set<int> alwaysOnNeighbours;   // learnt from their ACKs
+	/* end always-on sink state */
+
 	/* begin debug functions */
 	void printNonFatalError(string);
 	void printFatalError(string);
@@ -160,13 +217,13 @@ private:
 	/* end power control functions */
 
 	/* begin backoff state and functions */
-	int myBackoff;        // current position in backoff array
-	int maxBackoff;
+	map<int, int> backoffStages;   // failed attempts in a row, by destination
+	int initialBackoffWindow;      // from .ned file, in ms
+	int maxBackoff;                // from .ned file, in ms
 	const static int bmacBackoffs [BMAC_NUMBER_OF_BACKOFF_INCREMENTS];   // backoff units, in ms
-	inline double getCurrentBackoff() const;
-	double increaseBackoff();
-	double decreaseBackoff();
-	void resetBackoff();
+	int getBackoffStage(int destination) const;
+	double increaseBackoff(int destination);
+	void resetBackoff(int destination);
 	/* end backoff state and functions */
 
 	/* buffer management */
@@ -187,14 +244,17 @@ private:
 protected:
 	void startup();
 	void reset();
+	void finishSpecific();
 	void timerFiredCallback(int);
 	void fromNetworkLayer(cPacket *, int);
 	void fromRadioLayer(cPacket *, double, double);
 	int handleRadioControlMessage(cMessage *);
+	int handleControlCommand(cMessage *);
 };
 
 const string BMAC::BmacStateNames [BMAC_NUMBER_OF_STATES] = { "BMAC_STATE_SLEEP", "BMAC_STATE_RSSISAMPLE", "BMAC_STATE_WFRADIORSSI", "BMAC_STATE_LISTEN",	"BMAC_STATE_WFDATA", "BMAC_STATE_WFACK", "BMAC_STATE_PRESENDCCA", "BMAC_STATE_PREAMBLE_SEND", "BMAC_STATE_STARTUP" };
-const string BMAC::BmacTimerNames [BMAC_NUMBER_OF_TIMERS] = { "BMAC_TIMER_CHECKPERIOD", "BMAC_TIMER_ACKTIMEOUT", "BMAC_TIMER_LISTENTIMEOUT", "BMAC_TIMER_WAITFORPREAMBLE", "BMAC_TIMER_WFRADIO_CCA", "BMAC_TIMER_RETRY", "BMAC_TIMER_RETRYWAKEUP", "BMAC_TIMER_WAITFORACKTX" };
+const string BMAC::BmacTimerNames [BMAC_NUMBER_OF_TIMERS] = { "BMAC_TIMER_CHECKPERIOD", "BMAC_TIMER_ACKTIMEOUT", "BMAC_TIMER_LISTENTIMEOUT", "BMAC_TIMER_WAITFORPREAMBLE", "BMAC_TIMER_WFRADIO_CCA", "BMAC_TIMER_RETRY", "BMAC_TIMER_RETRYWAKEUP", "BMAC_TIMER_WAITFORACKTX", "BMAC_TIMER_CCA_SAMPLE", "BMAC_TIMER_WAKEFORDATA", "BMAC_TIMER_DIRECTSEND" };
+PreambleRegistry BMAC::preambleRegistry;
 const int    BMAC::bmacBackoffs   [BMAC_NUMBER_OF_BACKOFF_INCREMENTS] = {32, 64, 96, 128, 256, 512};   // backoff units, in ms. empirical.
 
 
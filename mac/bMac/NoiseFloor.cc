@@ -0,0 +1,53 @@
+/**
+ *  NoiseFloor.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Noise floor estimate for clear channel assessment in the B-MAC protocol.
+ *
+ */
+
+#include "NoiseFloor.h"
+#include <algorithm>
+#include <vector>
+
+/**
+ *  @param initialFloor Estimate to use until samples have been taken (dBm).
+ *  @param alpha        Weight of each new median in the moving average.
+ *  @param queueLength  Number of recent samples the median is taken over.
+ */
+NoiseFloor::NoiseFloor(double initialFloor, double alpha, int queueLength) {
+	this->floor = initialFloor;
+	this->alpha = alpha;
+	this->queueLength = (queueLength < 1) ? 1 : queueLength;
+}
+
+NoiseFloor::~NoiseFloor() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Records a sample taken while the channel was believed to be idle, and
+ *  updates the estimate.
+ */
+void NoiseFloor::addIdleSample(double rssi) {
+	samples.push_back(rssi);
+	if (samples.size() > queueLength)
+		samples.pop_front();
+	floor = alpha*getMedian() + (1-alpha)*floor;
+}
+
+/**
+ *  @param margin Distance (dB) above the estimate that still counts as an
+ *                outlier, to allow for a noise floor that is almost constant.
+ *  @return True if the sample shows that the channel was idle when it was
+ *          taken.
+ */
+bool NoiseFloor::isOutlier(double rssi, double margin) const {
+	return (rssi < floor + margin);
+}
+
+double NoiseFloor::getMedian() const {
+	vector<double> sorted(samples.begin(), samples.end());
+	sort(sorted.begin(), sorted.end());
+	return sorted[sorted.size()/2];
+}
@@ -0,0 +1,40 @@
+/**
+ *  NoiseFloor.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Noise floor estimate for clear channel assessment in the B-MAC protocol
+ *  (Polastre, Hill and Culler, 2004). Signal strength samples taken when the
+ *  channel is believed to be idle are queued, and the median of the queue is
+ *  folded into an exponentially weighted moving average, so that a single
+ *  sample taken during a stray transmission does not drag the estimate up.
+ *
+ *  A sample well below the estimate cannot have been taken during a
+ *  transmission (a valid packet holds the signal above the noise floor
+ *  throughout), so a CCA that finds one such outlier among several samples
+ *  declares the channel clear.
+ *
+ */
+
+#ifndef NOISEFLOOR_H_
+#define NOISEFLOOR_H_
+
+#include <deque>
+
+using namespace std;
+
+class NoiseFloor {
+private:
+	double floor;       // dBm
+	double alpha;       // weight given to each new median
+	unsigned int queueLength;
+	deque<double> samples;   // most recent idle samples, oldest first
+	double getMedian() const;
+public:
+	NoiseFloor(double initialFloor, double alpha, int queueLength);
+	virtual ~NoiseFloor();
+	void addIdleSample(double rssi);
+	bool isOutlier(double rssi, double margin) const;
+	inline double getFloor() const { return floor; };
+};
+
+#endif /* NOISEFLOOR_H_ */
@@ -0,0 +1,123 @@
+/**
+ *  PreambleRegistry.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Long preambles in progress, for use in the B-MAC protocol.
+ *
+ */
+
+#include "PreambleRegistry.h"
+
+PreambleRegistry::PreambleRegistry() {
+}
+
+PreambleRegistry::~PreambleRegistry() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Registers a preamble, replacing any earlier one from the same sender.
+ *  Preambles that have already ended are dropped at the same time, so the
+ *  registry never holds more than one entry per node.
+ */
+void PreambleRegistry::add(const int macAddress, int destination, double x,
+		double y, double z, simtime_t start, simtime_t end, simtime_t dataTime) {
+	purge(start);
+	PreambleInterval preamble;
+	preamble.x = x;
+	preamble.y = y;
+	preamble.z = z;
+	preamble.destination = destination;
+	preamble.start = start;
+	preamble.end = end;
+	preamble.dataTime = dataTime;
+	preambles[macAddress] = preamble;
+}
+
+/**
+ *  Removes the sender's preamble, e.g. when it is cut short.
+ */
+void PreambleRegistry::remove(const int macAddress) {
+	preambles.erase(macAddress);
+}
+
+/**
+ *  @param macAddress MAC address of the node asking (its own preamble is
+ *                    ignored).
+ *  @param x, y, z    Location of the node asking.
+ *  @param range      Distance within which a preamble can be heard.
+ *  @param now        Current time.
+ *  @return True if any other node within range is sending a preamble now.
+ */
+bool PreambleRegistry::isBusy(const int macAddress, double x, double y,
+		double z, double range, simtime_t now) const {
+	map<int, PreambleInterval>::const_iterator it;
+	for (it = preambles.begin(); it != preambles.end(); ++it) {
+		if ((it->first != macAddress)
+				&& isAudible(it->second, x, y, z, range, now))
+			return true;
+	}
+	return false;
+}
+
+/**
+ *  Looks for a preamble in progress within range that is addressed to the
+ *  node asking (or broadcast), i.e. one whose data it should stay awake for.
+ *  If there are several, the one whose data comes first is returned.
+ *
+ *  @param broadcastAddress MAC address used for broadcasts.
+ *  @param preamble         Set to the preamble found, if any.
+ *  @return True if such a preamble was found.
+ */
+bool PreambleRegistry::findPreambleFor(const int macAddress, double x,
+		double y, double z, double range, simtime_t now, int broadcastAddress,
+		PreambleInterval& preamble) const {
+	bool found = false;
+	map<int, PreambleInterval>::const_iterator it;
+	for (it = preambles.begin(); it != preambles.end(); ++it) {
+		if ((it->first != macAddress)
+				&& ((it->second.destination == macAddress)
+						|| (it->second.destination == broadcastAddress))
+				&& isAudible(it->second, x, y, z, range, now)
+				&& (!found || (it->second.dataTime < preamble.dataTime))) {
+			preamble = it->second;
+			found = true;
+		}
+	}
+	return found;
+}
+
+/**
+ *  @return True if the preamble is in progress now and within range.
+ */
+bool PreambleRegistry::isAudible(const PreambleInterval& preamble, double x,
+		double y, double z, double range, simtime_t now) const {
+	if ((now < preamble.start) || (now >= preamble.end)) {
+		return false;
+	}
+	double dx = preamble.x-x;
+	double dy = preamble.y-y;
+	double dz = preamble.z-z;
+	return (dx*dx+dy*dy+dz*dz <= range*range);
+}
+
+/**
+ *  Drops every preamble that has ended by the given time.
+ */
+void PreambleRegistry::purge(simtime_t now) {
+	map<int, PreambleInterval>::iterator it = preambles.begin();
+	while (it != preambles.end()) {
+		if (it->second.end <= now) {
+			preambles.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+/**
+ *  Drops every preamble, e.g. left over from a previous run.
+ */
+void PreambleRegistry::clear() {
+	preambles.clear();
+}
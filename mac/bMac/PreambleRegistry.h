@@ -0,0 +1,60 @@
+/**
+ *  PreambleRegistry.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Long preambles in progress, for use in the B-MAC protocol. Rather than
+ *  occupying the radio with a preamble packet (which the simulator delivers
+ *  as a separate event to every node in range), a sender registers the time
+ *  interval during which it would be sending its preamble, together with its
+ *  location. A node doing clear channel assessment asks the registry whether
+ *  any preamble in range is in progress, which is a single lookup.
+ *
+ *  Each preamble also records its destination and when the data will follow
+ *  it, as an addressed preamble would, so that nodes that find the channel
+ *  busy can tell whether to stay awake for the data.
+ *
+ *  Preambles are heard within a fixed range of the sender (a disk model),
+ *  which should match the range of the radio in the deployment being
+ *  simulated. One registry is shared by every node in the simulation, so it
+ *  must be cleared at the start of each run.
+ *
+ */
+
+#ifndef PREAMBLEREGISTRY_H_
+#define PREAMBLEREGISTRY_H_
+
+#include <map>
+#include "VirtualMac.h"
+
+using namespace std;
+
+struct PreambleInterval {
+	double x, y, z;      // location of the sender
+	int destination;     // MAC address, may be BROADCAST_MAC_ADDRESS
+	simtime_t start;
+	simtime_t end;
+	simtime_t dataTime;  // when the sender will start sending the data
+};
+
+class PreambleRegistry {
+private:
+	map<int, PreambleInterval> preambles;   // keyed by sender's MAC address
+	bool isAudible(const PreambleInterval& preamble, double x, double y,
+			double z, double range, simtime_t now) const;
+public:
+	PreambleRegistry();
+	virtual ~PreambleRegistry();
+	void add(const int macAddress, int destination, double x, double y,
+			double z, simtime_t start, simtime_t end, simtime_t dataTime);
+	void remove(const int macAddress);
+	bool isBusy(const int macAddress, double x, double y, double z,
+			double range, simtime_t now) const;
+	bool findPreambleFor(const int macAddress, double x, double y, double z,
+			double range, simtime_t now, int broadcastAddress,
+			PreambleInterval& preamble) const;
+	void purge(simtime_t now);
+	void clear();
+	inline int size() const { return preambles.size(); };
+};
+
+#endif /* PREAMBLEREGISTRY_H_ */
@@ -0,0 +1,64 @@
+/**
+ *  ContentionWindow.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Slotted contention window, with uniform or Sift slot selection.
+ *
+ */
+
+#include "ContentionWindow.h"
+#include <cmath>
+
+/**
+ *  @param numSlots     Number of slots in the window (at least 1).
+ *  @param slotTime     Length of each slot, in seconds. This should be at
+ *                      least the time taken to detect a carrier.
+ *  @param useSift      Choose slots with the Sift distribution rather than
+ *                      uniformly.
+ *  @param siftMaxNodes Largest number of simultaneous contenders that the
+ *                      Sift distribution is tuned for.
+ */
+ContentionWindow::ContentionWindow(int numSlots, double slotTime, bool useSift,
+		int siftMaxNodes) {
+	this->numSlots = (numSlots < 1) ? 1 : numSlots;
+	this->slotTime = slotTime;
+	this->useSift = useSift && (this->numSlots > 1) && (siftMaxNodes > 1);
+	alpha = this->useSift ? pow(double(siftMaxNodes), -1.0/(this->numSlots-1))
+	                      : 1.0;
+}
+
+ContentionWindow::~ContentionWindow() {
+}
+
+/**
+ *  Picks the slot in which to contend.
+ *
+ *  With Sift, slot r (counting from 1) is chosen with probability
+ *  (1-alpha)*alpha^CW/(1-alpha^CW) * alpha^-r, which is inverted here so that
+ *  a single uniform sample gives the slot directly.
+ *
+ *  @param uniformSample Random number, uniformly distributed in [0, 1).
+ *  @return The slot, counting from 0.
+ */
+int ContentionWindow::chooseSlot(double uniformSample) const {
+	int slot;
+	if (!useSift) {
+		slot = int(uniformSample*numSlots);
+	} else {
+		double alphaCw = pow(alpha, numSlots);
+		double r = numSlots - log(uniformSample*(1.0-alphaCw)+alphaCw)/log(alpha);
+		slot = int(ceil(r))-1;
+	}
+	if (slot < 0) return 0;
+	if (slot >= numSlots) return numSlots-1;
+	return slot;
+}
+
+/**
+ *  @param slot Slot, counting from 0.
+ *  @return Time from the start of the window to the start of the slot, in
+ *          seconds.
+ */
+double ContentionWindow::getSlotStart(int slot) const {
+	return slot*slotTime;
+}
@@ -0,0 +1,38 @@
+/**
+ *  ContentionWindow.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Slotted contention window, shared by the MAC protocols that contend for
+ *  the medium with a random delay (S-MAC in its listen period, MACAW in the
+ *  CONTEND state). The window is divided into a fixed number of slots, and a
+ *  contender picks one; it senses the carrier at the start of its slot and
+ *  only transmits if nobody in an earlier slot has started.
+ *
+ *  Slots can be chosen uniformly, or with the increasing-probability
+ *  distribution of Sift (Jamieson, Balakrishnan and Tay, 2006), in which
+ *  later slots are exponentially more likely. With Sift, when many nodes
+ *  contend at once, the earliest slot is still usually taken by only one of
+ *  them, so collisions stay rare without having to widen the window.
+ *
+ */
+
+#ifndef CONTENTIONWINDOW_H_
+#define CONTENTIONWINDOW_H_
+
+class ContentionWindow {
+private:
+	int numSlots;
+	double slotTime;   // seconds
+	bool useSift;
+	double alpha;      // Sift distribution parameter
+public:
+	ContentionWindow(int numSlots, double slotTime, bool useSift,
+			int siftMaxNodes);
+	virtual ~ContentionWindow();
+	int chooseSlot(double uniformSample) const;
+	double getSlotStart(int slot) const;
+	inline int getNumSlots() const { return numSlots; };
+	inline double getSlotTime() const { return slotTime; };
+};
+
+#endif /* CONTENTIONWINDOW_H_ */
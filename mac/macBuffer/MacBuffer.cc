@@ -26,7 +26,7 @@ template <typename T>
 void MacBuffer<T>::insertPacket(T packet) {
 	if (buffer.size() >= maxSize)
 		throw MacBufferFullException();
-	buffer.push(packet);
+	buffer.push_back(packet);
 	if (printDebugInfo) {
 		//castalia->trace() << "Added a packet to the MAC buffer. "
 		//		          << "Number of buffered packets: "
@@ -39,6 +39,16 @@ T MacBuffer<T>::peek() {
 	return buffer.front();
 }
 
+/*
+ *  Looks further into the buffer than the front, e.g. to see whether the next
+ *  packet is for the same destination. The position must be less than
+ *  numPackets().
+ */
+template <typename T>
+T MacBuffer<T>::peek(int position) {
+	return buffer.at(position);
+}
+
 template <typename T>
 int MacBuffer<T>::numPackets() {
 	return buffer.size();
@@ -46,7 +56,7 @@ int MacBuffer<T>::numPackets() {
 
 template <typename T>
 void MacBuffer<T>::removeFirst() {
-	buffer.pop();
+	buffer.pop_front();
 }
 
 template <typename T>
@@ -11,7 +11,7 @@
 #ifndef MACBUFFER_H_
 #define MACBUFFER_H_
 
-#include <queue>
+#include <deque>
 #include "MockObjects.h"
 #include "VirtualMac.h"
 #include "MacBufferFullException.h"
@@ -21,7 +21,7 @@ using namespace std;
 template <typename T>
 class MacBuffer {
 private:
-	queue<T> buffer;
+	deque<T> buffer;
 	CastaliaModule* castalia;
 	int maxSize;
 	bool printDebugInfo;
@@ -29,6 +29,7 @@ public:
 	MacBuffer(CastaliaModule* castalia, int maxSize, bool printDebugInfo);
 	void insertPacket(T packet);
 	T peek();
+	T peek(int position);   // 0 is the front of the buffer
 	int numPackets();
 	void removeFirst();
 	inline bool isEmpty() { return (buffer.empty()); };
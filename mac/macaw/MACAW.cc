@@ -44,6 +44,15 @@ void MACAW::startup() {
 	// max value for a random timer (e.g. IDLE->CONTEND), in ms
 	defaultMaxRndTimerValue = par("defaultMaxRndTimerValue");
 
+	// slotted contention window for the CONTEND state
+	slottedContention              = par("slottedContention");
+	int contentionWindowSlots      = par("contentionWindowSlots");
+	double contentionSlotTime      = par("contentionSlotTime");
+	bool siftContention            = par("siftContention");
+	int siftMaxNodes               = par("siftMaxNodes");
+	contentionWindow = new ContentionWindow(contentionWindowSlots,
+			contentionSlotTime, siftContention, siftMaxNodes);
+
 	myBackoff         = par("initialBackoff");
 	backoffResetValue = myBackoff;
 	backoffDecrement  = par("backoffDecrement");
@@ -145,6 +154,19 @@ void MACAW::handleSendPauseTimerCallback() {
 }
 
 void MACAW::handleContendTimerCallback() {
+	// an overheard exchange has made us defer; we contend afresh once
+	// the quiet period is over
+	if (currentState != MACAW_STATE_CONTEND)
+		return;
+	// slotted contention: someone in an earlier slot has started, so
+	// keep quiet until the medium is free rather than collide with them,
+	// and only then draw a new window
+	if (slottedContention && (radioModule->isChannelClear() != CLEAR)) {
+		printInfo("Lost contention (medium busy). Deferring.");
+		setTimer(MACAW_TIMER_QUIET, contentionWindow->getSlotTime());
+		setState(MACAW_STATE_QUIET);
+		return;
+	}
 	sendRTS(remoteStation, ++currentSequenceNumber);
 	setTimer(MACAW_TIMER_CTS_TIMEOUT, maxCtsTimeout);
 }
@@ -177,9 +199,15 @@ void MACAW::handleWfdsTimeoutTimerCallback() {
 }
 
 void MACAW::handleQuietTimerCallback() {
+	// the sender we deferred to may still be on the air without us having
+	// decoded its packet yet; wait another slot rather than contend now
+	if (slottedContention && (radioModule->isChannelClear() != CLEAR)) {
+		setTimer(MACAW_TIMER_QUIET, contentionWindow->getSlotTime());
+		return;
+	}
 	if (currentState == MACAW_STATE_WFCONTEND) {
 		// timeout rule 1
-		setTimer(MACAW_TIMER_CONTEND, getRandomTimerValue());
+		setTimer(MACAW_TIMER_CONTEND, getContendTimerValue());
 		setState(MACAW_STATE_CONTEND, remoteStation);
 	} else {
 		// timeout rule 2
@@ -254,7 +282,7 @@ void MACAW::sendBufferedDataPacket() {
 	// get front of buffer so we can extract the destination
 	MacawPacket* bufferFront = check_and_cast <MacawPacket*>(macBuffer->peek());  // this doesn't need duplicating because we're not sending it to the radio layer in this method
 
-	setTimer(MACAW_TIMER_CONTEND, getRandomTimerValue());
+	setTimer(MACAW_TIMER_CONTEND, getContendTimerValue());
 	setState(MACAW_STATE_CONTEND, bufferFront->getDestination());
 }
 
@@ -268,6 +296,15 @@ inline double MACAW::getRandomTimerValue() const {
 	return getRandomTimerValue(defaultMinRndTimerValue, defaultMaxRndTimerValue);
 }
 
+// returns timer value in seconds: the start of a slot in the contention
+// window, or a uniform random timer if slotted contention is disabled
+double MACAW::getContendTimerValue() {
+	if (!slottedContention) return getRandomTimerValue();
+	int slot = contentionWindow->chooseSlot(rand()/(RAND_MAX+1.0));
+	trace() << "Contending in slot " << slot;
+	return contentionWindow->getSlotStart(slot);
+}
+
 
 void MACAW::reset() {
 	setState(MACAW_STATE_IDLE);
@@ -275,6 +312,14 @@ void MACAW::reset() {
 		cancelTimer(i);
 }
 
+/*
+ *  Called by the simulator at the end of the run.
+ */
+void MACAW::finishSpecific() {
+	delete contentionWindow;
+	contentionWindow = NULL;
+}
+
 /*
  *  Method called to perform a state transition.
  *  If we are transitioning to the IDLE state, we will check the transmission
@@ -681,6 +726,20 @@ int MACAW::handleRadioControlMessage(cMessage*) {
 	return 0;
 }
 
+/*
+ *  Commands from the routing layer carry information that other MAC
+ *  protocols make use of, but we don't, so they are accepted and ignored.
+ *
+ *  @return 1 if the command was handled; 0 otherwise.
+ */
+int MACAW::handleControlCommand(cMessage* msg) {
+	if (dynamic_cast <MacControlMessage*>(msg) == NULL) {
+		printNonFatalError("Unrecognised control command. Ignoring.");
+		return 0;
+	}
+	return 1;
+}
+
 inline bool MACAW::alreadyAcked(int source, int seqNum) {
 	return (remoteStationList->getESN(source) > seqNum);
 }
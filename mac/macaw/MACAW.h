@@ -13,10 +13,12 @@
 
 #include "VirtualMac.h"
 #include "../macBuffer/MacBuffer.h"
+#include "../macControl/MacControlMessage_m.h"
 #include "MacawPacket_m.h"
 #include "RemoteStationList.h"
 #include "RemoteStation.h"
 #include "RemoteStationNotFoundException.h"
+#include "../contentionWindow/ContentionWindow.h"
 #include <assert.h>
 #include <string>
 #include "../../CastaliaIncludes.h"
@@ -127,6 +129,9 @@ private:
 	int defaultMaxRndTimerValue;  // max value for a random timer (e.g. IDLE->CONTEND), in ms
 	inline double getRandomTimerValue(const int min, const int max) const;  // args in ms, returns in seconds
 	inline double getRandomTimerValue() const;
+	bool slottedContention;
+	ContentionWindow* contentionWindow;
+	double getContendTimerValue();   // returns in seconds
 	/* end timer control functions */
 
 	/* begin timer callback functions */
@@ -199,10 +204,12 @@ private:
 protected:
 	void startup();
 	void reset();
+	void finishSpecific();
 	void timerFiredCallback(int);
 	void fromNetworkLayer(cPacket *, int);
 	void fromRadioLayer(cPacket *, double, double);
 	int handleRadioControlMessage(cMessage *);
+	int handleControlCommand(cMessage *);
 };
 
 const string MACAW::MacawStateNames [MACAW_NUMBER_OF_STATES] = { "MACAW_STATE_IDLE", "MACAW_STATE_CONTEND",	"MACAW_STATE_WFCTS", "MACAW_STATE_WFCONTEND", "MACAW_STATE_WFDATA", "MACAW_STATE_WFDS", "MACAW_STATE_WFACK", "MACAW_STATE_QUIET" };
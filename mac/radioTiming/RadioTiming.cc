@@ -0,0 +1,57 @@
+/**
+ *  RadioTiming.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Timing of the radio, shared by the MAC protocols.
+ *
+ */
+
+#include "RadioTiming.h"
+#include "VirtualMac.h"
+
+RadioTiming::RadioTiming(double dataRate, int frameOverhead,
+		double turnaroundTime, double wakeupDelay) {
+	this->dataRate = dataRate;
+	this->frameOverhead = frameOverhead;
+	this->turnaroundTime = turnaroundTime;
+	this->wakeupDelay = wakeupDelay;
+	this->secondsPerByte = 8.0/(1000*dataRate);
+}
+
+RadioTiming::~RadioTiming() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Creates the timing model for a MAC, from its .ned parameters. Stops the
+ *  simulation if the radio is not one we know.
+ *
+ *  @param radio Name of a radio whose timing is known (only "CC2420" at
+ *               present), in which case the remaining parameters are
+ *               ignored, or "" to use them.
+ *  @return A new timing model, which the caller must delete.
+ */
+RadioTiming* RadioTiming::create(const string& radio, double dataRate,
+		int frameOverhead, double turnaroundTime, double wakeupDelay) {
+	if (radio == "CC2420") {
+		/* TelosB, MicaZ: 250kbps, 6 bytes of synchronisation header and
+		 * length field, 12 symbol (192us) RX/TX turnaround. The wakeup delay
+		 * is the one measured for the B-MAC and X-MAC implementations. */
+		return new RadioTiming(250, 6, 0.000192, 0.0005);
+	}
+	if (radio != "") {
+		opp_error("Radio timing: unknown phyRadio \"%s\"", radio.c_str());
+	}
+	return new RadioTiming(dataRate, frameOverhead, turnaroundTime,
+			wakeupDelay);
+}
+
+/**
+ *  @return The largest number of bytes (excluding the physical layer
+ *          overhead) that can be sent in the given time, e.g. to size a
+ *          preamble packet.
+ */
+int RadioTiming::getBytesInTime(double seconds) const {
+	int bytes = (int)(seconds/secondsPerByte + 1e-9) - frameOverhead;
+	return (bytes < 0) ? 0 : bytes;
+}
@@ -0,0 +1,45 @@
+/**
+ *  RadioTiming.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Timing of the radio, shared by the MAC protocols, so that airtimes and the
+ *  durations derived from them (preambles, check periods, strobe spacing)
+ *  are all worked out in the same way, from the same four values: the data
+ *  rate, the physical layer overhead added to every frame, the time to turn
+ *  the radio round between receiving and transmitting, and the time for the
+ *  radio to wake up from sleep. They are either those of a known radio, or
+ *  taken from a MAC's .ned parameters (see create()).
+ *
+ */
+
+#ifndef RADIOTIMING_H_
+#define RADIOTIMING_H_
+
+#include <string>
+
+using namespace std;
+
+class RadioTiming {
+private:
+	double dataRate;         // kbps
+	int frameOverhead;       // bytes
+	double turnaroundTime;   // seconds
+	double wakeupDelay;      // seconds
+	double secondsPerByte;
+public:
+	RadioTiming(double dataRate, int frameOverhead, double turnaroundTime,
+			double wakeupDelay);
+	virtual ~RadioTiming();
+	static RadioTiming* create(const string& radio, double dataRate,
+			int frameOverhead, double turnaroundTime, double wakeupDelay);
+	inline double getTxTime(int numBytes) const {
+		return (frameOverhead+numBytes)*secondsPerByte;
+	};
+	int getBytesInTime(double seconds) const;
+	inline double getDataRate() const { return dataRate; };
+	inline int getFrameOverhead() const { return frameOverhead; };
+	inline double getTurnaroundTime() const { return turnaroundTime; };
+	inline double getWakeupDelay() const { return wakeupDelay; };
+};
+
+#endif /* RADIOTIMING_H_ */
@@ -12,6 +12,8 @@
 #include "../macBuffer/MacBuffer.h"
 #include "../../CastaliaIncludes.h"
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 
 /**
  *  Register the protocol with Castalia.
@@ -31,6 +33,12 @@ void SMAC::startup() {
 	if (SELF_MAC_ADDRESS == 1)
 	srand(SELF_MAC_ADDRESS);
 
+	// fixed clock drift for this node, instead of the resource manager's
+	if (par("overrideClockDrift")) {
+		double clockDriftPpm = par("clockDriftPpm");
+		setTimerDrift(1.0 + clockDriftPpm/1000000.0);
+	}
+
 	// initialise parameters from .ned file
 	printDebuggingInfo = par("printDebugInfo");
 	sendDataEnabled    = par("sendDataEnabled");
@@ -45,20 +53,29 @@ void SMAC::startup() {
 	declareOutput("Number of DATA packets received");
 	declareOutput("Number of SYNCs received");
 	declareOutput("Number of acks received");
+	declareOutput("Number of adaptive listens");
+	declareOutput("Number of fragments retransmitted");
+	declareOutput("Number of NAV sleeps");
+	declareOutput("Number of broadcast DATA packets sent");
+	declareOutput("Number of broadcast DATA packets received");
+	declareOutput("Time in NAV sleep");
+	declareOutput("Number of contentions lost");
+	declareOutput("Number of PROBEs sent");
 
 	// initialise internal state
 	currentSequenceNumber = 0;
 
-	printInfo("Resizing schedule table");
-	scheduleTable.resize(MAX_NODES);
 	printInfo("Initialising schedule table");
-	for (long i=0; i<MAX_NODES; i++) {
-		scheduleTable.at(i) = 0;
-	}
+	scheduleTable = new ScheduleTable();
 	printInfo("Schedule table initialised");
 
 	scount = getRandom(int(par("minScount")), int(par("maxScount")));
-	numWakeups = 0;
+	scountMultiplier = 1;
+	int syncGuardTimeMs = par("syncGuardTime");
+	syncGuardTime = double(syncGuardTimeMs)/1000.0;
+	maxScountMultiplier = par("maxScountMultiplier");
+	currentFrame = -1;
+	nextFrame = 0;
 	sinkMacAddress = par("sinkMacAddress");
 	isSink = (SELF_MAC_ADDRESS == sinkMacAddress);
 	trace() << "Initialised scount to " << scount;
@@ -72,6 +89,8 @@ void SMAC::startup() {
 
 	syncListenPeriod = double(syncListenPeriodMs)/1000.0;
 	rtsListenPeriod = double(rtsListenPeriodMs)/1000.0;
+	listenPeriod = syncListenPeriod+rtsListenPeriod;
+	maxFollowedSchedules = par("maxFollowedSchedules");
 	listenSleepPeriod = double(listenSleepPeriodMs)/1000.0;
 
 	sendTimerMin = par("sendTimerMin");
@@ -79,8 +98,65 @@ void SMAC::startup() {
 
 	constOverhead = par("constOverhead");
 
+	phyDataRate      = par("phyDataRate");
+	phyFrameOverhead = par("phyFrameOverhead");
+	// (wakeup is allowed for by constOverhead, rather than the timing model)
+	radioTiming = RadioTiming::create(par("phyRadio").stdstringValue(),
+			phyDataRate, phyFrameOverhead, par("phyTurnaroundTime"), 0);
+
+	adaptiveListening = par("adaptiveListening");
+	int adaptiveListenPeriodMs = par("adaptiveListenPeriod");
+	adaptiveListenPeriod = double(adaptiveListenPeriodMs)/1000.0;
+	navGuardTime = par("navGuardTime");
+	inAdaptiveListen = false;
+
+	overhearingAvoidance = par("overhearingAvoidance");
+	messagePassing = par("messagePassing");
+	maxBurstFragments = par("maxBurstFragments");
+	burstFragmentsLeft = 0;
+	lastDataSource = -1;
+	lastDataSeqNumber = -1;
+
+	maxFrameLevel = par("maxFrameLevel");
+	idleFramesBeforeStretch = par("idleFramesBeforeStretch");
+	frameLevel = 0;
+	framePhase = 0;
+	framePhaseSource = SELF_MAC_ADDRESS;
+	trafficThisFrame = false;
+	idleFrames = 0;
+
 	overheardRts = false;
 	overheardCts = false;
+	mediumBusyUntil = 0;
+
+	piggybackRouting = par("piggybackRouting");
+	hasRoutingPayload = false;
+	routingPayload = 0;
+
+	staggeredWakeup = par("staggeredWakeup");
+	int staggerSlotTimeMs = par("staggerSlotTime");
+	staggerSlotTime = double(staggerSlotTimeMs)/1000.0;
+	maxStaggerDepth = par("maxStaggerDepth");
+	hopsToSink = -1;
+	appliedStagger = 0;
+	if (staggeredWakeup && !piggybackRouting) {
+		// neighbours' hop counts reach the routing layer on our SYNC reports
+		opp_error("S-MAC: staggeredWakeup requires piggybackRouting");
+	}
+
+	slottedContention = par("slottedContention");
+	int contentionWindowSlots = par("contentionWindowSlots");
+	double contentionSlotTime = par("contentionSlotTime");
+	bool siftContention = par("siftContention");
+	int siftMaxNodes = par("siftMaxNodes");
+	contentionWindow = new ContentionWindow(contentionWindowSlots,
+			contentionSlotTime, siftContention, siftMaxNodes);
+
+	fastScheduleAcquisition = par("fastScheduleAcquisition");
+	int probeIntervalMs = par("probeInterval");
+	probeInterval = double(probeIntervalMs)/1000.0;
+	syncBurstLength = par("syncBurstLength");
+	syncBurstLeft = 0;
 
 	// initial startup time (seconds)
 	int minInitialScheduleWaitTimeMs = par("minInitialScheduleWaitTime");
@@ -101,6 +177,7 @@ void SMAC::startup() {
 	trace() << "My MAC address: " << SELF_MAC_ADDRESS;
 
 	macBuffer = new MacBuffer<SMacPacket*>(this, 25, true);
+	broadcastBuffer = new MacBuffer<SMacPacket*>(this, 25, true);
 
 	// ... and go ...
 	initialisationComplete = false;
@@ -108,6 +185,9 @@ void SMAC::startup() {
 	setTimer(SMAC_TIMER_BS, getRandomSeconds(minInitialScheduleWaitTime,
 			maxInitialScheduleWaitTime));
 	trace() << "Set BS timer for " << getTimer(SMAC_TIMER_BS) << "s.";
+	if (fastScheduleAcquisition) {
+		setTimer(SMAC_TIMER_PROBE, getRandomSeconds(0.0, probeInterval));
+	}
 
 	printInfo("Startup method complete");
 }
@@ -144,6 +224,21 @@ void SMAC::timerFiredCallback(int timer) {
 	                                   break;
 	case SMAC_TIMER_WFBSTX         :   handleWfBsTxTimerCallback();
 	                                   break;
+	case SMAC_TIMER_ADAPTIVE_LISTEN:   handleAdaptiveListenTimerCallback();
+	                                   break;
+	case SMAC_TIMER_NAV            :   handleNavTimerCallback();
+	                                   break;
+	case SMAC_TIMER_SECONDARY_WAKEUP:  handleSecondaryWakeupTimerCallback();
+	                                   break;
+	case SMAC_TIMER_BROADCAST_DATA :   handleBroadcastDataTimerCallback();
+	                                   break;
+	case SMAC_TIMER_PROBE          :   handleProbeTimerCallback();
+	                                   break;
+	case SMAC_TIMER_SYNC_BURST     :   handleSyncBurstTimerCallback();
+	                                   break;
+	case SMAC_TIMER_CONTENTION_DEFERRED:
+	                                   handleContentionDeferredTimerCallback();
+	                                   break;
 	default : printNonFatalError("Unrecognised timer callback");  break;
 	}
 }
@@ -158,6 +253,8 @@ void SMAC::timerFiredCallback(int timer) {
  */
 void SMAC::handleWakeupTimerCallback() {
 	printInfo("Handling WAKEUP timer");
+	inAdaptiveListen = false;
+	adaptFrameLength();
 	wakeUp();
 	setTimer(SMAC_TIMER_RTS_LISTEN, syncListenPeriod);
 	setTimer(SMAC_TIMER_LISTEN_TIMEOUT, double(getListenTimeoutValue())/1000.0);
@@ -176,6 +273,55 @@ void SMAC::handleWakeupTimerCallback() {
 
 }
 
+/**
+ *  Handler method for SMAC_TIMER_SECONDARY_WAKEUP.
+ *  The timer is set on going to sleep if we follow another schedule (as a
+ *  border node between clusters) whose listen window comes later in the
+ *  current frame. We listen for RTSs (and SYNCs) until the end of that window,
+ *  and may also send buffered data to a destination on that schedule. Our own
+ *  frame count and schedule are unaffected.
+ */
+void SMAC::handleSecondaryWakeupTimerCallback() {
+	if (currentState != SMAC_STATE_SLEEP) {
+		printInfo("Already awake for another schedule's listen window");
+		return;
+	}
+	simtime_t frameTime = currentFrame*listenSleepPeriod+primarySchedule;
+	simtime_t now = getClock()-frameTime;
+	for (unsigned int i = 1; i < listenWindows.size(); i++) {
+		if ((listenWindows[i].first <= now) && (now < listenWindows[i].second)) {
+			printInfo("Waking up to follow another schedule");
+			toRadioLayer(createRadioCommand(SET_STATE, RX));
+			active = true;
+			setState(SMAC_STATE_LISTEN_FOR_RTS);
+			setTimer(SMAC_TIMER_LISTEN_TIMEOUT,
+					SIMTIME_DBL(listenWindows[i].second-now));
+			if (!bufferIsEmpty()
+					&& isInWindow(macBuffer->peek()->getDestination(), i)) {
+				setTimer(SMAC_TIMER_SEND, getSendDelay());
+			}
+			return;
+		}
+	}
+	printNonFatalError("SECONDARY WAKEUP timer fired outside a listen window");
+	goToSleep();
+}
+
+/**
+ *  @param macAddress A neighbour's MAC address.
+ *  @param window     Index of one of our listen windows.
+ *  @return True if the neighbour's listen period starts within the window.
+ */
+bool SMAC::isInWindow(int macAddress, int window) {
+	if (!scheduleTable->contains(macAddress)) return (window == 0);
+	simtime_t offset = scheduleTable->getOffset(macAddress);
+	simtime_t start = listenWindows[window].first;
+	simtime_t end = listenWindows[window].second;
+	return ((offset >= start) && (offset < end))
+			|| ((offset+listenSleepPeriod >= start)
+					&& (offset+listenSleepPeriod < end));
+}
+
 /**
  *  Handler method for SMAC_TIMER_RTS_LISTEN.
  *  The timer fires when it is time to transition from the LISTEN_FOR_SYNC
@@ -186,10 +332,51 @@ void SMAC::handleWakeupTimerCallback() {
  */
 void SMAC::handleRtsListenTimerCallback() {
 	setState(SMAC_STATE_LISTEN_FOR_RTS);
-	if (!bufferIsEmpty()) {
-		setTimer(SMAC_TIMER_SEND, getRandomSeconds(sendTimerMin, sendTimerMax));
+	if (!bufferIsEmpty()
+			&& isInWindow(macBuffer->peek()->getDestination(), 0)) {
+		setTimer(SMAC_TIMER_SEND, getSendDelay()
+				+getWaitForDestination(macBuffer->peek()->getDestination()));
 		trace() << "Set SEND timer for " << getTimer(SMAC_TIMER_SEND) << "ms";
 	}
+	if (!broadcastBuffer->isEmpty()) {
+		setTimer(SMAC_TIMER_BROADCAST_DATA, getSendDelay());
+	}
+}
+
+/**
+ *  Handler method for SMAC_TIMER_BROADCAST_DATA.
+ *  The timer is set at a random point in our listen window when we have
+ *  broadcast data buffered, in frames that all our neighbours wake up for
+ *  (see adaptFrameLength()). If the medium is free (we have not overheard an
+ *  unfinished handshake, and the radio's carrier sense agrees) the packet at
+ *  the front of the broadcast buffer is sent; otherwise we back off and try
+ *  again later in the window, or in the next one.
+ */
+void SMAC::handleBroadcastDataTimerCallback() {
+	if (broadcastBuffer->isEmpty()) return;
+	if ((currentState != SMAC_STATE_LISTEN_FOR_RTS) || !active) {
+		printInfo("Busy or asleep. Delaying broadcast.");
+		return;
+	}
+	// wait for a frame that every neighbour wakes up for
+	map<int, int>::iterator it;
+	for (it = neighbourFrameLevels.begin(); it != neighbourFrameLevels.end();
+			++it) {
+		if (!isAwakeInCurrentFrame(it->first)) {
+			printInfo("Not all neighbours awake this frame. Delaying broadcast.");
+			return;
+		}
+	}
+	if (overheardRts || overheardCts
+			|| (radioModule->isChannelClear() != CLEAR)) {
+		printInfo("Medium busy. Backing off broadcast.");
+		setTimer(SMAC_TIMER_BROADCAST_DATA, getSendDelay());
+		return;
+	}
+	sendBroadcastData();
+	if (!broadcastBuffer->isEmpty()) {
+		setTimer(SMAC_TIMER_BROADCAST_DATA, getSendDelay());
+	}
 }
 
 /**
@@ -206,7 +393,9 @@ void SMAC::handleSyncBroadcastTimerCallback() {
 	printInfo("Handling SYNC BROADCAST timer");
 	if (currentState == SMAC_STATE_SYNC_BCAST_WAIT) {
 		broadcastSync();
-		scount = getRandom(int(par("minScount")), int(par("maxScount")));
+		adaptSyncInterval();
+		scount = scountMultiplier*getRandom(int(par("minScount")),
+				int(par("maxScount")));
 		if (getTimer(SMAC_TIMER_RTS_LISTEN) != 0) {
 			setState(SMAC_STATE_LISTEN_FOR_SYNC);
 		} else {
@@ -221,9 +410,22 @@ void SMAC::handleSyncBroadcastTimerCallback() {
 /**
  *  Handler method for SMAC_TIMER_SEND.
  *  Initiates the handshake for sending a newly generated sensor reading.
+ *  With slotted contention the timer fires at the start of our slot, and we
+ *  only send if nobody in an earlier slot has started; otherwise we wait
+ *  for the medium to be free before contending again (see deferContention()).
  */
 void SMAC::handleSendTimerCallback() {
-	if (currentState == SMAC_STATE_LISTEN_FOR_RTS) {
+	if ((currentState == SMAC_STATE_LISTEN_FOR_RTS) && !inAdaptiveListen
+			&& !bufferIsEmpty()
+			&& !isAwakeInCurrentFrame(macBuffer->peek()->getDestination())) {
+		printInfo("Destination is asleep this frame. Delaying transmission.");
+	} else if ((currentState == SMAC_STATE_LISTEN_FOR_RTS) && slottedContention
+			&& (overheardRts || overheardCts
+					|| (radioModule->isChannelClear() != CLEAR))) {
+		printInfo("Lost contention (medium busy). Deferring.");
+		collectOutput("Number of contentions lost", SELF_MAC_ADDRESS);
+		deferContention();
+	} else if (currentState == SMAC_STATE_LISTEN_FOR_RTS) {
 		sendBufferedDataPacket();
 	} else {
 		printInfo("Communication is progress or asleep. "
@@ -263,6 +465,7 @@ void SMAC::handleListenTimeoutCallback() {
  */
 void SMAC::handleBsTimerCallback() {
 	printInfo("BS timer callback... creating schedule");
+	cancelTimer(SMAC_TIMER_PROBE);
 	createSchedule();
 
 	// (re)broadcast the schedule
@@ -294,6 +497,123 @@ void SMAC::handleWfBsTxTimerCallback() {
 	goToSleep();
 }
 
+/**
+ *  Handler method for SMAC_TIMER_PROBE.
+ *  While we are still waiting for a schedule, asks any neighbours that are
+ *  awake to send us one, and sets the timer again. The probe interval is
+ *  shorter than the listen period, so a probe falls in every listen period of
+ *  every neighbour within range. If the medium is busy we back off briefly
+ *  instead, as the probe would only collide (and what we hear may well give
+ *  us a schedule anyway).
+ */
+void SMAC::handleProbeTimerCallback() {
+	if (currentState != SMAC_STATE_LISTEN_FOR_SCHEDULE) return;
+	if (radioModule->isChannelClear() != CLEAR) {
+		printInfo("Medium busy. Backing off PROBE.");
+		setTimer(SMAC_TIMER_PROBE,
+				getRandomSeconds(syncBroadcastTimeMin, syncBroadcastTimeMax));
+		return;
+	}
+	sendProbe();
+	setTimer(SMAC_TIMER_PROBE, probeInterval);
+}
+
+/**
+ *  Handler method for SMAC_TIMER_SYNC_BURST.
+ *  The timer is set when we hear a newcomer's PROBE, and sends the SYNCs of
+ *  the burst in reply, one per firing, at random times so that neighbours
+ *  replying to the same PROBE are unlikely to collide. The rest of the burst
+ *  is abandoned if we get involved in an exchange or go to sleep, as the
+ *  newcomer will probe again.
+ */
+void SMAC::handleSyncBurstTimerCallback() {
+	if (!active || ((currentState != SMAC_STATE_LISTEN_FOR_SYNC)
+			&& (currentState != SMAC_STATE_LISTEN_FOR_RTS))) {
+		printInfo("Busy or asleep. Abandoning SYNC burst.");
+		syncBurstLeft = 0;
+		return;
+	}
+	if (overheardRts || overheardCts
+			|| (radioModule->isChannelClear() != CLEAR)) {
+		printInfo("Medium busy. Backing off SYNC burst.");
+		setTimer(SMAC_TIMER_SYNC_BURST,
+				getRandomSeconds(syncBroadcastTimeMin, syncBroadcastTimeMax));
+		return;
+	}
+	broadcastSync();
+	if (--syncBurstLeft > 0) {
+		setTimer(SMAC_TIMER_SYNC_BURST,
+				getRandomSeconds(syncBroadcastTimeMin, syncBroadcastTimeMax));
+	}
+}
+
+/**
+ *  Handler method for SMAC_TIMER_CONTENTION_DEFERRED.
+ *  The timer is set when we lose slotted contention, and fires when the
+ *  exchange that beat us should be over. A new contention window is only
+ *  drawn once the medium is actually free; until then we keep deferring.
+ *  Anything else that has rescheduled the send in the meantime (a NAV sleep,
+ *  the next wakeup) takes precedence.
+ */
+void SMAC::handleContentionDeferredTimerCallback() {
+	if ((currentState != SMAC_STATE_LISTEN_FOR_RTS) || bufferIsEmpty()
+			|| (getTimer(SMAC_TIMER_SEND) != 0)) {
+		return;
+	}
+	if (isMediumBusy()) {
+		deferContention();
+		return;
+	}
+	setTimer(SMAC_TIMER_SEND, getSendDelay());
+}
+
+/**
+ *  Handler method for SMAC_TIMER_ADAPTIVE_LISTEN.
+ *  The timer is set when we overhear part of an exchange between two other
+ *  nodes, and fires when that exchange is due to finish (as advertised in the
+ *  NAV field of the overheard packet). If we have gone to sleep in the
+ *  meantime, we wake briefly in case we are the next hop of the data that
+ *  was just sent, so that it can be forwarded without waiting for our next
+ *  scheduled listen period.
+ */
+void SMAC::handleAdaptiveListenTimerCallback() {
+	if (currentState == SMAC_STATE_SLEEP) {
+		startAdaptiveListen();
+	} else {
+		printInfo("Already awake at end of overheard exchange");
+	}
+}
+
+/**
+ *  Handler method for SMAC_TIMER_NAV.
+ *  The timer fires at the end of an exchange that we overheard and slept
+ *  through (see sleepForNav()). If our listen period is still running we turn
+ *  the radio back on and carry on listening; otherwise we listen adaptively (in
+ *  case we are the next hop of the data) or go back to sleep until the next
+ *  schedule point.
+ */
+void SMAC::handleNavTimerCallback() {
+	if (currentState != SMAC_STATE_NAV_SLEEP) {
+		printInfo("Woken up during NAV by schedule");
+		return;
+	}
+	// we slept through the DATA and ACK that would have cleared these
+	overheardRts = false;
+	overheardCts = false;
+	if (active) {
+		toRadioLayer(createRadioCommand(SET_STATE, RX));
+		setState(SMAC_STATE_LISTEN_FOR_RTS);
+		if (!bufferIsEmpty()) {
+			setTimer(SMAC_TIMER_SEND, getSendDelay());
+		}
+	} else if (adaptiveListening) {
+		startAdaptiveListen();
+	} else {
+		setState(SMAC_STATE_SLEEP);
+		goToSleep();
+	}
+}
+
 /**
  *  Handler method for SMAC_TIMER_CTSREC_TIMEOUT.
  *  The timer fires when we time out on not receiving a CTS from a station to
@@ -314,11 +634,18 @@ void SMAC::handleWfBsTxTimerCallback() {
  *  on the transmission.
  */
 void SMAC::handleCtsRecTimeoutTimerCallback() {
+	/* the destination may have lengthened its frame since we last heard
+	 * from it, so assume that it has                                    */
+	int destination = macBuffer->peek()->getDestination();
+	if (neighbourFrameLevels[destination] < maxFrameLevel) {
+		neighbourFrameLevels[destination]++;
+	}
 	if (!active) {
 		// try again when we're next active
 		numRetries = 0;
 		setState(SMAC_STATE_SLEEP);
 		goToSleep();
+		return;
 	}
 	if (numRetries < maxRetries) {
 		// retry
@@ -352,9 +679,22 @@ void SMAC::handleDataTimeoutCallback() {
 
 /**
  *  Handler method for SMAC_TIMER_ACK_TIMEOUT.
- *
+ *  With message passing, the receiver stays awake until the end of the burst
+ *  (and our neighbours are asleep for it), so only the lost fragment is
+ *  retransmitted, straight away and without another RTS/CTS, whether or not
+ *  our listen period has ended.
  */
 void SMAC::handleAckTimeoutCallback() {
+	/* within a burst, the receiver is kept awake (and the medium reserved) by
+	 * the burst's NAV, so a lost fragment can be resent straight away */
+	if (messagePassing && (burstFragmentsLeft > 1) && (numRetries < maxRetries)) {
+		printInfo("Retransmitting lost fragment");
+		collectOutput("Number of fragments retransmitted", SELF_MAC_ADDRESS);
+		numRetries++;
+		sendDataFromFrontOfBuffer();
+		return;
+	}
+	burstFragmentsLeft = 0;
 	if (!active) {
 		// will be retried when we're next active
 		numRetries = 0;
@@ -375,35 +715,16 @@ void SMAC::handleAckTimeoutCallback() {
 }
 
 /**
- *  Iterates over the schedule table and returns the largest offset present.
- *  Useful for determining by how much longer than our default active time we
- *  need to stay awake in order that we might overlap with all of our
- *  neighbours' schedules.
- *
- *  @return The largest offset present in the schedule table.
- */
-simtime_t SMAC::getMaxScheduleTableOffset() {
-	simtime_t maxOffset = 0;
-	for (long i=0; i<MAX_NODES; i++) {
-		if (scheduleTable.at(i) > maxOffset) maxOffset = scheduleTable.at(i);
-	}
-	return maxOffset;
-}
-
-/**
- *  Iterates over the schedule table and returns the smallest offset present.
- *  Useful for ensuring that we don't wake up before we need to (and
- *  potentially transmit when none of our neighbours are listening, as well as
- *  being wasteful of energy).
- *
- *  @return The smallest offset present in the schedule table.
+ *  Recomputes the windows in which we listen during each frame from the
+ *  schedule table. The first window contains our own listen period and any
+ *  neighbours' that overlap it; we wake up at its start on each frame
+ *  (handleWakeupTimerCallback()). Border nodes also follow up to
+ *  maxFollowedSchedules-1 other schedules, each in a window of its own later
+ *  in the frame (handleSecondaryWakeupTimerCallback()), sleeping in between.
  */
-simtime_t SMAC::getMinScheduleTableOffset() {
-	simtime_t minOffset = getMaxScheduleTableOffset();
-	for (long i=0; i<MAX_NODES; i++) {
-		if (scheduleTable.at(i) < minOffset) minOffset = scheduleTable.at(i);
-	}
-	return minOffset;
+void SMAC::updateListenWindows() {
+	scheduleTable->getListenWindows(listenPeriod, listenSleepPeriod,
+			maxFollowedSchedules, listenWindows);
 }
 
 
@@ -411,11 +732,10 @@ simtime_t SMAC::getMinScheduleTableOffset() {
  *  Calculates and returns the value that the listen timeout should be set to
  *  upon wakeup (in milliseconds).
  *
- *  The maximum offset from the schedule table is added to the calculated
- *  current frame time to ensure that we don't go to sleep prematurely and
- *  potentially miss overlapping with the schedules of our neighbours.
- *  An adjustment of half the listen-sleep period is necessary since the frame
- *  time refers to awakenings, and here we are interested in when to sleep.
+ *  The end of the first listen window (see updateListenWindows()) is added to
+ *  the calculated current frame time to ensure that we don't go to sleep
+ *  prematurely and potentially miss overlapping with the schedules of our
+ *  neighbours.
  *
  *  @return the value that the listen timeout should be set to upon wakeup,
  *          in milliseconds.
@@ -423,9 +743,9 @@ simtime_t SMAC::getMinScheduleTableOffset() {
 double SMAC::getListenTimeoutValue() {
 
 	simtime_t currentTime = getClock();
-	simtime_t frameTime   = (numWakeups-1)*listenSleepPeriod + primarySchedule;
-	simtime_t maxScheduleOffset = getMaxScheduleTableOffset();
-	simtime_t listenTermination = frameTime+maxScheduleOffset+0.5*listenSleepPeriod;
+	simtime_t frameTime   = currentFrame*listenSleepPeriod + primarySchedule;
+	updateListenWindows();
+	simtime_t listenTermination = frameTime+listenWindows[0].second;
 	simtime_t listenTime        = listenTermination - currentTime;
 
 	// SIMTIME_DBL is defined in simtime_t.h from OMNeT++
@@ -440,9 +760,9 @@ double SMAC::getListenTimeoutValue() {
 
 /**
  *  Value that the wakeup timer should be set to upon sleeping (in ms), i.e.
- *  the next frame time minus the current time. There's no point in waking up
- *  before our neighbours do, so we add the minimum offset in the schedule
- *  table to the wakeup time.
+ *  the next frame time minus the current time. We wake up at the start of the
+ *  first listen window, which is earlier than our own listen period if it
+ *  overlaps with that of a neighbour who wakes up before us.
  *
  *  @return the value that the wakeup timer should be set to upon sleeping,
  *          in milliseconds.
@@ -450,10 +770,11 @@ double SMAC::getListenTimeoutValue() {
 double SMAC::getWakeupTimerValue() {
 
 	simtime_t currentTime       = getClock();
-	simtime_t frameTime         = numWakeups*listenSleepPeriod
+	simtime_t frameTime         = nextFrame*listenSleepPeriod
 			                                     + primarySchedule;
-	simtime_t minScheduleOffset = getMinScheduleTableOffset();
-	simtime_t wakeupValue       = frameTime+minScheduleOffset-currentTime;
+	updateListenWindows();
+	simtime_t wakeupValue       = frameTime+listenWindows[0].first-currentTime;
+	if (wakeupValue < 0) wakeupValue = 0;   // listening for the whole frame
 
 	//trace() << "FRAME TIME IS " << frameTime;
 	//trace() << "WAKEUPTIMERVALUE should be returning " << wakeupValue;
@@ -610,11 +931,30 @@ void SMAC::goToSleep() {
 	toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
 
 	active = false;
+	inAdaptiveListen = false;
 	overheardRts = false;
 	overheardCts = false;
+	cancelTimer(SMAC_TIMER_SYNC_BURST);
+	syncBurstLeft = 0;
 
+	applyStagger();
+	nextFrame = getNextFrame();
 	setTimer(SMAC_TIMER_WAKEUP, double(getWakeupTimerValue())/1000.0);
 
+	/* wake up again this frame if we follow another schedule later in it */
+	if (currentFrame >= 0) {
+		simtime_t frameTime = currentFrame*listenSleepPeriod+primarySchedule;
+		for (unsigned int i = 1; i < listenWindows.size(); i++) {
+			simtime_t windowStart = frameTime+listenWindows[i].first;
+			if ((windowStart > getClock())
+					&& (windowStart-getClock() < getTimer(SMAC_TIMER_WAKEUP))) {
+				setTimer(SMAC_TIMER_SECONDARY_WAKEUP,
+						SIMTIME_DBL(windowStart-getClock()));
+				break;
+			}
+		}
+	}
+
 }
 
 /*
@@ -625,7 +965,271 @@ void SMAC::wakeUp() {
 	printInfo("Waking up");
 	toRadioLayer(createRadioCommand(SET_STATE, RX));
 	active = true;
-	numWakeups++;
+	currentFrame = nextFrame;
+}
+
+/**
+ *  Records that there has been traffic in the current frame. The frame is
+ *  shortened straight away (to the base frame length) so that the exchange
+ *  and any that follow it, e.g. the next hop forwarding the data, are not
+ *  held up; it is lengthened again gradually once the traffic has stopped.
+ */
+void SMAC::noteTraffic() {
+	trafficThisFrame = true;
+	idleFrames = 0;
+	if (frameLevel > 0) {
+		printInfo("Traffic: shortening frame");
+		frameLevel = 0;
+	}
+}
+
+/**
+ *  Called on each wakeup, to take account of the traffic in the frame that
+ *  has just ended. After idleFramesBeforeStretch consecutive frames with no
+ *  traffic and nothing buffered, the frame length is doubled, up to
+ *  listenSleepPeriod*2^maxFrameLevel. The listen period is unchanged, so
+ *  doubling the frame halves our duty cycle.
+ */
+void SMAC::adaptFrameLength() {
+	if (trafficThisFrame || !bufferIsEmpty()) {
+		idleFrames = 0;
+	} else if ((++idleFrames >= idleFramesBeforeStretch)
+			&& (frameLevel < maxFrameLevel)) {
+		frameLevel++;
+		idleFrames = 0;
+		trace() << "Idle: frame level now " << frameLevel;
+	}
+	trafficThisFrame = false;
+}
+
+/**
+ *  Wakeups always fall on the base frame grid (multiples of listenSleepPeriod
+ *  from primarySchedule), so that schedule table offsets are unaffected by the
+ *  frame length. At frame level l we only wake up for base frames whose
+ *  superframe position is a multiple of 2^l. Since neighbours agree on the
+ *  superframe position of each frame (see learnFramePhase()), any two
+ *  neighbours are both awake at least every 2^max(l1, l2) base frames,
+ *  whatever their levels.
+ *
+ *  @return The index of the next base frame that we should wake up for.
+ */
+int SMAC::getNextFrame() {
+	int frame = currentFrame+1;
+	while (getSuperframePosition(frame) % (1 << frameLevel) != 0) {
+		frame++;
+	}
+	return frame;
+}
+
+/**
+ *  @return Position of the given base frame within a superframe of
+ *          2^maxFrameLevel base frames, as agreed with our neighbours.
+ */
+int SMAC::getSuperframePosition(int frame) {
+	int superframeLength = 1 << maxFrameLevel;
+	return (((frame+framePhase) % superframeLength) + superframeLength)
+			% superframeLength;
+}
+
+/**
+ *  @param macAddress A neighbour's MAC address.
+ *  @return True if the neighbour is awake in the current frame, as far as we
+ *          know its frame level. Neighbours we have not heard from are assumed
+ *          to wake up on every frame.
+ */
+bool SMAC::isAwakeInCurrentFrame(int macAddress) {
+	map<int, int>::iterator it = neighbourFrameLevels.find(macAddress);
+	int level = (it == neighbourFrameLevels.end()) ? 0 : it->second;
+	return (getSuperframePosition(currentFrame) % (1 << level) == 0);
+}
+
+/**
+ *  Every packet advertises its sender's frame level. We remember it, so that
+ *  we only start a handshake in frames where the destination is awake.
+ */
+void SMAC::learnFrameLevel(SMacPacket* macPacket) {
+	neighbourFrameLevels[macPacket->getSource()] = macPacket->getFrameLevel();
+}
+
+/**
+ *  SYNC packets also advertise the superframe position of the frame whose
+ *  sleep time they carry. Every node adopts the phase originating from the
+ *  lowest MAC address it has heard of, so that a connected network converges
+ *  on a single phase. Must be called after the schedule from the packet has
+ *  been added or adopted.
+ */
+void SMAC::learnFramePhase(SMacPacket* macPacket) {
+	if (macPacket->getFramePhaseSource() > framePhaseSource) return;
+
+	// index of the advertised frame in terms of our own frames
+	simtime_t advertisedWakeup = macPacket->getSyncValue()+constOverhead
+			-listenPeriod;
+	int frame = int(floor(SIMTIME_DBL(advertisedWakeup-primarySchedule)
+			/listenSleepPeriod + 0.5));
+
+	int superframeLength = 1 << maxFrameLevel;
+	framePhase = (((macPacket->getFramePosition()-frame) % superframeLength)
+			+ superframeLength) % superframeLength;
+	framePhaseSource = macPacket->getFramePhaseSource();
+	trace() << "Frame phase now " << framePhase << " from "
+			<< framePhaseSource;
+}
+
+/**
+ *  Turns off the radio until the end of an exchange (or burst) between two
+ *  other nodes, without affecting our schedule, rather than receiving the
+ *  rest of it for nothing. SMAC_TIMER_NAV decides what to do when the exchange
+ *  is over (so the adaptive listen timer is not needed). The radio's own
+ *  accounting shows the time in the sleep state; the time is also recorded
+ *  here.
+ *
+ *  @param nav Time remaining in the exchange, as advertised in the overheard
+ *             packet.
+ */
+void SMAC::sleepForNav(simtime_t nav) {
+	printInfo("Sleeping until the end of an overheard exchange");
+	collectOutput("Number of NAV sleeps", SELF_MAC_ADDRESS);
+	collectOutput("Time in NAV sleep", SELF_MAC_ADDRESS, "seconds",
+			SIMTIME_DBL(nav));
+	cancelTimer(SMAC_TIMER_SEND);
+	cancelTimer(SMAC_TIMER_CONTENTION_DEFERRED);
+	cancelTimer(SMAC_TIMER_ADAPTIVE_LISTEN);
+	toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+	setState(SMAC_STATE_NAV_SLEEP);
+	setTimer(SMAC_TIMER_NAV, SIMTIME_DBL(nav));
+}
+
+/**
+ *  @param hops Hop count to the sink, or -1 if unknown.
+ *  @return How much later than the rest of its cluster a node this many hops
+ *          from the sink wakes up with staggered wakeups. Nodes
+ *          maxStaggerDepth or more hops away (or that don't know) are not
+ *          shifted, and each hop closer shifts the schedule by one more
+ *          stagger slot, so the sink wakes up last.
+ */
+simtime_t SMAC::getStagger(int hops) {
+	if (!staggeredWakeup || (hops < 0) || (hops >= maxStaggerDepth)) return 0;
+	return (maxStaggerDepth-hops)*staggerSlotTime;
+}
+
+/**
+ *  Moves our primary schedule if our stagger has changed since it was last
+ *  applied (i.e. the routing layer has told us of a new hop count to the
+ *  sink). Called on going to sleep, before the next wakeup is worked out, so
+ *  that the current listen period is not cut short. Neighbours hear of the
+ *  new schedule in our next SYNC.
+ */
+void SMAC::applyStagger() {
+	simtime_t stagger = getStagger(hopsToSink);
+	if (stagger == appliedStagger) return;
+	simtime_t shift = stagger-appliedStagger;
+	primarySchedule += shift;
+	scheduleTable->reduceAll(shift);
+	appliedStagger = stagger;
+	trace() << "Staggered schedule by " << stagger << " (" << hopsToSink
+			<< " hops to sink)";
+}
+
+/**
+ *  With staggered wakeups, our next hop may start listening a little after
+ *  we do. Handshakes to it are held back until its RTS listen period.
+ *
+ *  @param destination MAC address of the node we are sending to.
+ *  @return Time until the destination's RTS listen period starts in the
+ *          current frame, in seconds (0 if it has already started).
+ */
+double SMAC::getWaitForDestination(int destination) {
+	if (!staggeredWakeup) return 0;
+	simtime_t frameTime = currentFrame*listenSleepPeriod+primarySchedule;
+	simtime_t destinationRtsListen = frameTime
+			+scheduleTable->getOffset(destination)+syncListenPeriod;
+	simtime_t wait = destinationRtsListen-getClock();
+	return (wait > 0) ? SIMTIME_DBL(wait) : 0;
+}
+
+/**
+ *  Listens for a short time (adaptiveListenPeriod) at the end of an exchange,
+ *  either one that we took part in after our scheduled listen period ended,
+ *  or one that we overheard. If we have data to send (e.g. the packet that
+ *  we just received, passed back down by the routing layer), it is sent
+ *  during this window rather than waiting for the next frame.
+ *
+ *  The node is not considered active, so it goes back to sleep at the end of
+ *  the window (or of any exchange started within it). The frame count is not
+ *  incremented, so our schedule is unaffected.
+ */
+void SMAC::startAdaptiveListen() {
+	if ((currentState == SMAC_STATE_SLEEP)
+			|| (currentState == SMAC_STATE_NAV_SLEEP)) {
+		printInfo("Waking up for adaptive listen");
+		toRadioLayer(createRadioCommand(SET_STATE, RX));
+	}
+	collectOutput("Number of adaptive listens", SELF_MAC_ADDRESS);
+	inAdaptiveListen = true;
+	setState(SMAC_STATE_LISTEN_FOR_RTS);
+	setTimer(SMAC_TIMER_LISTEN_TIMEOUT, adaptiveListenPeriod);
+	if (!bufferIsEmpty()) {
+		setTimer(SMAC_TIMER_SEND, getAdaptiveSendDelay());
+		trace() << "Set SEND timer for " << getTimer(SMAC_TIMER_SEND) << "s";
+	}
+}
+
+/**
+ *  Random delay before sending within an adaptive listen window, between a
+ *  quarter and a half of the window. The lower bound leaves time for the end
+ *  of the previous exchange to clear and for our next hop (which overheard
+ *  it) to wake up.
+ *
+ *  @return The delay, in seconds.
+ */
+double SMAC::getAdaptiveSendDelay() {
+	return getRandomSeconds(0.25*adaptiveListenPeriod, 0.5*adaptiveListenPeriod);
+}
+
+/**
+ *  Delay from the start of the RTS listen period (or from when the medium
+ *  became free) before we try to send. With slotted contention this is the
+ *  start of a slot of the contention window, chosen uniformly or with the
+ *  Sift distribution; otherwise it is uniform between sendTimerMin and
+ *  sendTimerMax.
+ *
+ *  @return The delay, in seconds.
+ */
+double SMAC::getSendDelay() {
+	if (!slottedContention) return getRandomSeconds(sendTimerMin, sendTimerMax);
+	int slot = contentionWindow->chooseSlot(rand()/(RAND_MAX+1.0));
+	trace() << "Contending in slot " << slot;
+	return contentionWindow->getSlotStart(slot);
+}
+
+/**
+ *  @return Whether an overheard exchange is still in progress according to
+ *          its NAV, or the radio senses a carrier.
+ */
+bool SMAC::isMediumBusy() {
+	return (simTime() < mediumBusyUntil)
+			|| (radioModule->isChannelClear() != CLEAR);
+}
+
+/**
+ *  Puts off contending for the medium after losing a slotted contention.
+ *  Drawing a new window straight away would only lose again while the winner
+ *  is still on the air, so we wait until the end of its advertised NAV, or
+ *  for a slot at a time if we have only sensed its carrier.
+ */
+void SMAC::deferContention() {
+	simtime_t wait = mediumBusyUntil - simTime();
+	if (wait <= 0) wait = contentionWindow->getSlotTime();
+	setTimer(SMAC_TIMER_CONTENTION_DEFERRED, SIMTIME_DBL(wait));
+}
+
+/**
+ *  @param numBytes Length of the MAC packet, excluding the physical layer
+ *                  overhead.
+ *  @return Time taken to transmit a packet of the given length, in seconds.
+ */
+double SMAC::getTxTime(int numBytes) {
+	return radioTiming->getTxTime(numBytes);
 }
 
 /*
@@ -642,6 +1246,14 @@ void SMAC::sendBufferedDataPacket() {
 	// (this is reset when a data packet is deleted from the buffer)
 	numRetries++;
 
+	/* everything in the buffer is for the same destination (see
+	 * fromNetworkLayer()), so reserve the medium for as much of it as we can */
+	if (messagePassing) {
+		burstFragmentsLeft = min(macBuffer->numPackets(), maxBurstFragments);
+	} else {
+		burstFragmentsLeft = 1;
+	}
+
 	sendRTS(macPacket->getDestination());
 	setTimer(SMAC_TIMER_CTSREC_TIMEOUT, ctsTimeout);
 }
@@ -663,6 +1275,11 @@ void SMAC::sendDataFromFrontOfBuffer() {
 	dataPacket->setSource(SELF_MAC_ADDRESS);
 	dataPacket->setType(SMAC_PACKET_DATA);
 	dataPacket->setSequenceNumber(currentSequenceNumber);
+	dataPacket->setFragmentsToFollow(burstFragmentsLeft-1);
+	dataPacket->setFrameLevel(frameLevel);
+	dataPacket->setNav(getTxTime(0)+navGuardTime          // our ACK
+			+getBurstNav(burstFragmentsLeft-1));         // rest of the burst
+	setScheduleFields(dataPacket);
 
 	setState(SMAC_STATE_WFACK);
 	setTimer(SMAC_TIMER_ACK_TIMEOUT, ackTimeout);
@@ -673,6 +1290,42 @@ void SMAC::sendDataFromFrontOfBuffer() {
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
 }
 
+/**
+ *  Works out how long the given number of DATA fragments and their ACKs will
+ *  occupy the medium. Fragments are assumed to be the same length as the one
+ *  at the front of the buffer; each DATA packet advertises the remainder of
+ *  the burst afresh, so neighbours' NAVs are corrected as the burst goes on.
+ *
+ *  @param numFragments Number of fragments.
+ *  @return The time, in seconds.
+ */
+simtime_t SMAC::getBurstNav(int numFragments) {
+	if ((numFragments <= 0) || bufferIsEmpty()) return 0;
+	SMacPacket* front = check_and_cast <SMacPacket*>(macBuffer->peek());
+	return numFragments*(getTxTime(front->getByteLength())+getTxTime(0)
+			+2*navGuardTime);
+}
+
+/**
+ *  Sends the packet at the front of the broadcast buffer to all neighbours
+ *  listening in our window, without an RTS/CTS handshake and without waiting
+ *  for any ACKs (which would collide). The caller must have checked that the
+ *  medium is free. The packet is sent once only: neighbours which miss it are
+ *  expected to be covered by the routing layer's own retries.
+ */
+void SMAC::sendBroadcastData() {
+	printInfo("Broadcasting data packet");
+	collectOutput("Number of broadcast DATA packets sent", SELF_MAC_ADDRESS);
+	SMacPacket* dataPacket = broadcastBuffer->peek();
+	broadcastBuffer->removeFirst();
+	dataPacket->setNav(0);
+	dataPacket->setFragmentsToFollow(0);
+	dataPacket->setFrameLevel(frameLevel);
+	setScheduleFields(dataPacket);
+	toRadioLayer(dataPacket);
+	toRadioLayer(createRadioCommand(SET_STATE, TX));
+}
+
 /*
  *  Broadcasts a SYNC packet
  */
@@ -691,6 +1344,13 @@ void SMAC::broadcastSync() {
 	syncPacket->setType(SMAC_PACKET_SYNC);
 	syncPacket->setSequenceNumber(0); // seq number doesn't make sense for SYNCs
 	syncPacket->setSyncValue(syncValue);
+	syncPacket->setFrameLevel(frameLevel);
+	syncPacket->setFramePosition(getSuperframePosition(currentFrame+1));
+	syncPacket->setFramePhaseSource(framePhaseSource);
+	syncPacket->setHasRoutingPayload(piggybackRouting && hasRoutingPayload);
+	syncPacket->setRoutingPayload(routingPayload);
+	syncPacket->setHopsToSink(hopsToSink);
+	syncPacket->setScheduleStagger(appliedStagger);
 
 	printInfo("Sending SYNC packet to radio layer");
 	toRadioLayer(syncPacket);
@@ -702,12 +1362,15 @@ void SMAC::broadcastSync() {
  *  The schedule table stores positive offsets from this (i.e. the time at which
  *  other nodes wake up).
  *
- *  Offsets of nodes that are not our neighbours, or that we have not yet heard
- *  from, are assumed to be 0.
+ *  Only nodes that we have heard a SYNC from are stored in the table. Offsets
+ *  of nodes that are not our neighbours, or that we have not yet heard from,
+ *  are assumed to be 0.
  *
- *  Arguments: value is from the sync packet.
+ *  Arguments: value is from the sync packet, as is sourceStagger (which is
+ *  left out of the phase used to estimate drift, so that a change in the
+ *  source's stagger does not look like clock drift).
  */
-void SMAC::addSchedule(int source, simtime_t value) {
+void SMAC::addSchedule(int source, simtime_t value, simtime_t sourceStagger) {
 	printInfo("Adding/updating schedule in schedule table");
 	trace() << "  Source: " << source;
 
@@ -724,39 +1387,61 @@ void SMAC::addSchedule(int source, simtime_t value) {
 
 	//simtime_t otherNodePrimarySchedule = nextSynchronisedAwakening;
 	simtime_t otherNodePrimarySchedule = nextSynchronisedSleep;
-	while ((otherNodePrimarySchedule-listenSleepPeriod)>primarySchedule)
-		otherNodePrimarySchedule -= listenSleepPeriod;
-	otherNodePrimarySchedule -= 0.5*listenSleepPeriod;
+	otherNodePrimarySchedule -= listenPeriod;
+	scheduleTable->recordPhase(source, otherNodePrimarySchedule-sourceStagger,
+			listenSleepPeriod, getClock());
 	trace() << "Other node's primary schedule value: "
 			<< otherNodePrimarySchedule;
 
+	/*  the offset is taken to within half a frame either side of our own
+	 *  schedule. This is done in closed form rather than one frame at a time,
+	 *  since after long clock divergence the other node's value may be a great
+	 *  many frames away.                                                     */
 	simtime_t newOffset = otherNodePrimarySchedule-primarySchedule;
-	if (newOffset<0) newOffset=newOffset*(-1);  // equivalent to doing abs
+	newOffset -= listenSleepPeriod
+			*floor(SIMTIME_DBL(newOffset)/listenSleepPeriod+0.5);
 	trace() << "New offset in schedule table: "
 			<< newOffset;
 
-	try {
-		scheduleTable.at(source) = newOffset;
-	} catch (exception& e) {
-		printFatalError("Tried to add node MAC address that exceeds MAX_NODES "
-				"to schedule");
-	}
-
-	/*  now, if the largest offset in the schedule table is greater than half of
-	 *  the listen-sleep period, adjust primarySchedule accordingly.          */
-	if (newOffset > (listenSleepPeriod*0.5)) {
-		printInfo("New offset is too large. Adjusting schedule table "
-				"accordingly");
-		simtime_t reductionAmount = newOffset;
-		primarySchedule = otherNodePrimarySchedule;
-		for (long i=0; i<MAX_NODES; i++) {
-			scheduleTable.at(i) = scheduleTable.at(i)-reductionAmount;
-		}
-	}
+	/*  a neighbour on a different schedule is followed as well as our own
+	 *  (see updateListenWindows()), rather than us adopting its schedule, so
+	 *  that border nodes between clusters don't thrash between the two.      */
+	scheduleTable->update(source, newOffset);
 
 	printScheduleTable();
 }
 
+/**
+ *  Chooses how many of the usual SYNC intervals (minScount to maxScount
+ *  wakeups) to wait before sending the next SYNC, from the fastest drift
+ *  that we have measured between our clock and a neighbour's. The schedule
+ *  error accumulated over the longest interval is compared against
+ *  syncGuardTime: if it would still be below a quarter of the guard time with
+ *  the interval doubled, the interval is doubled (up to maxScountMultiplier
+ *  times the usual); if it is already above half the guard time, the
+ *  interval is halved. Until we have a drift estimate, SYNCs are sent at the
+ *  usual rate.
+ */
+void SMAC::adaptSyncInterval() {
+	if (!scheduleTable->hasDriftRates()) {
+		scountMultiplier = 1;
+		return;
+	}
+	double driftRate = scheduleTable->getMaxDriftRate();
+	double frameLength = listenSleepPeriod*(1 << frameLevel);
+	double longestInterval = scountMultiplier*int(par("maxScount"))*frameLength;
+	double error = driftRate*longestInterval;
+
+	if ((2*error < 0.25*syncGuardTime)
+			&& (scountMultiplier < maxScountMultiplier)) {
+		scountMultiplier *= 2;
+	} else if ((error > 0.5*syncGuardTime) && (scountMultiplier > 1)) {
+		scountMultiplier /= 2;
+	}
+	trace() << "Max drift rate " << driftRate << ", SYNC interval multiplier "
+			<< scountMultiplier;
+}
+
 /**
  *  Prints the schedule table out to the simulator trace file for debugging
  *  purposes.
@@ -764,8 +1449,10 @@ void SMAC::addSchedule(int source, simtime_t value) {
 void SMAC::printScheduleTable() {
 	if (printDebuggingInfo) {
 		printInfo("Outputting contents of schedule table");
-		for (long i=0; i<MAX_NODES; i++) {
-			trace() << "   " << scheduleTable.at(i);
+		ScheduleTable::const_iterator it;
+		for (it = scheduleTable->begin(); it != scheduleTable->end(); ++it) {
+			trace() << "   " << it->first << ": "
+					<< scheduleTable->getOffset(it->first);
 		}
 	}
 }
@@ -779,8 +1466,8 @@ void SMAC::printScheduleTable() {
 simtime_t SMAC::getScheduleValue() {
 	printInfo("Getting schedule value");
 
-	simtime_t nextWakeup = numWakeups*listenSleepPeriod + primarySchedule;
-	simtime_t nextSleep = nextWakeup + 0.5*listenSleepPeriod;
+	simtime_t nextWakeup = (currentFrame+1)*listenSleepPeriod + primarySchedule;
+	simtime_t nextSleep = nextWakeup + listenPeriod;
 	simtime_t broadcastedSleep = nextSleep - constOverhead;
 
 	trace() << "  Next wakeup: "            << nextWakeup;
@@ -804,7 +1491,8 @@ simtime_t SMAC::getScheduleValue() {
 void SMAC::adoptSchedule(int source, simtime_t value) {
 	printInfo("Adopting schedule");
 
-	primarySchedule = value-0.5*listenSleepPeriod;
+	primarySchedule = value-listenPeriod;
+	appliedStagger = 0;
 
 	if (printDebuggingInfo) {
 		trace() << "  Primary schedule set to " << primarySchedule;
@@ -840,6 +1528,59 @@ void SMAC::createSchedule() {
 
 }
 
+/**
+ *  Used in the LISTEN_FOR_SCHEDULE state, when we hear a packet carrying a
+ *  schedule (a SYNC, or with fast schedule acquisition any packet). Adopts the
+ *  schedule, rebroadcasts it, and goes to sleep until the first wakeup.
+ *
+ *  @param macPacket The packet carrying the schedule.
+ */
+void SMAC::acquireSchedule(SMacPacket* macPacket) {
+	cancelTimer(SMAC_TIMER_BS);
+	cancelTimer(SMAC_TIMER_PROBE);
+	initialisationComplete = true;
+	adoptSchedule(macPacket->getSource(),
+			macPacket->getSyncValue()-macPacket->getScheduleStagger());
+	learnFramePhase(macPacket);
+	broadcastSync();
+	setTimer(SMAC_TIMER_WAKEUP, double(getWakeupTimerValue())/1000.0);
+	/*  don't go to sleep immediately to give the schedule time to
+	 *  rebroadcast before changing radio state                  */
+	setTimer(SMAC_TIMER_WFBSTX, 0.0002);
+}
+
+/**
+ *  Broadcasts a PROBE, asking neighbours for their schedule.
+ */
+void SMAC::sendProbe() {
+	printInfo("Probing for a schedule");
+	collectOutput("Number of PROBEs sent", SELF_MAC_ADDRESS);
+	SMacPacket* probe = new SMacPacket("SMAC probe packet", MAC_LAYER_PACKET);
+	probe->setType(SMAC_PACKET_PROBE);
+	probe->setSource(SELF_MAC_ADDRESS);
+	probe->setDestination(BROADCAST_MAC_ADDRESS);
+	probe->setSequenceNumber(0);
+	probe->setFrameLevel(frameLevel);
+	toRadioLayer(probe);
+	toRadioLayer(createRadioCommand(SET_STATE, TX));
+}
+
+/**
+ *  With fast schedule acquisition, fills in our schedule on an outgoing
+ *  packet in the same way as on a SYNC, so that a newcomer that hears it can
+ *  adopt the schedule (see acquireSchedule()).
+ *
+ *  @param macPacket The packet about to be sent.
+ */
+void SMAC::setScheduleFields(SMacPacket* macPacket) {
+	if (!fastScheduleAcquisition || !initialisationComplete) return;
+	macPacket->setCarriesSchedule(true);
+	macPacket->setSyncValue(getScheduleValue());
+	macPacket->setFramePosition(getSuperframePosition(currentFrame+1));
+	macPacket->setFramePhaseSource(framePhaseSource);
+	macPacket->setScheduleStagger(appliedStagger);
+}
+
 /**
  *  Resets the protocol by cancelling all timers, creating and broadcasting
  *  a new schedule, and transitioning to the sleep state. It should only be
@@ -856,6 +1597,22 @@ void SMAC::reset() {
 		cancelTimer(i);
 }
 
+/**
+ *  Called by the simulator at the end of the run. Frees what startup()
+ *  allocated; packets still buffered belong to the module, and are freed by
+ *  the simulator.
+ */
+void SMAC::finishSpecific() {
+	delete radioTiming;
+	radioTiming = NULL;
+	delete scheduleTable;
+	scheduleTable = NULL;
+	delete contentionWindow;
+	contentionWindow = NULL;
+	delete broadcastBuffer;
+	broadcastBuffer = NULL;
+}
+
 /**
  *  Used to perform a state transition from the current state to the one
  *  indicated by the supplied argument. This method must be used whenever
@@ -886,6 +1643,24 @@ void SMAC::setState(int newState) {
 void SMAC::fromNetworkLayer(cPacket * netPacket, int destination) {
 	trace() << "In network layer method";
 
+	// broadcasts are sent without a handshake: see sendBroadcastData()
+	if (sendDataEnabled && (destination == BROADCAST_MAC_ADDRESS)) {
+		printInfo("Received a broadcast packet from the network layer");
+		SMacPacket* macPacket =
+				new SMacPacket("SMAC broadcast data packet", MAC_LAYER_PACKET);
+		encapsulatePacket(macPacket, netPacket);
+		macPacket->setType(SMAC_PACKET_DATA);
+		macPacket->setSource(SELF_MAC_ADDRESS);
+		macPacket->setDestination(BROADCAST_MAC_ADDRESS);
+		broadcastBuffer->insertPacket(macPacket);
+		noteTraffic();
+		if ((currentState == SMAC_STATE_LISTEN_FOR_RTS)
+				&& (getTimer(SMAC_TIMER_BROADCAST_DATA) == 0)) {
+			setTimer(SMAC_TIMER_BROADCAST_DATA, getSendDelay());
+		}
+		return;
+	}
+
 	// oddity of the routing layer, not us
 	destination = sinkMacAddress;
 
@@ -904,13 +1679,23 @@ void SMAC::fromNetworkLayer(cPacket * netPacket, int destination) {
 		 * sleep for some other reason, send it straight away                 */
 		trace() << "About to buffer MAC packet. Potential problems!!!";
 		macBuffer->insertPacket(macPacket);
+		noteTraffic();
 		if ((currentState == SMAC_STATE_LISTEN_FOR_RTS)
 				&& (macBuffer->numPackets() == 1)
 				&& (!overheardRts)
 				&& (!overheardCts)) {
-			/* NB it's OK to send it straight away due to the random delay
-			 * in when it was actually generated. 				 */
-			sendBufferedDataPacket();
+			if (inAdaptiveListen) {
+				/* probably a packet we have just received, being forwarded:
+				 * give the next hop time to wake up                         */
+				setTimer(SMAC_TIMER_SEND, getAdaptiveSendDelay());
+			} else if (!isAwakeInCurrentFrame(destination)) {
+				printInfo("Destination is asleep this frame. "
+						"Delaying transmission.");
+			} else {
+				/* NB it's OK to send it straight away due to the random delay
+				 * in when it was actually generated. 				 */
+				sendBufferedDataPacket();
+			}
 		} else {
 			printInfo("Delaying transmission of new packet.");
 		}
@@ -939,30 +1724,40 @@ void SMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			<< macPacket->getType() << ", forUs: " << forUs
 			<< ", state: " << SmacStateNames[currentState];
 
+	learnFrameLevel(macPacket);
+	if ((macPacket->getType() != SMAC_PACKET_SYNC)
+			&& (macPacket->getType() != SMAC_PACKET_PROBE)) {
+		noteTraffic();
+	}
+
+	/* a newcomer can take its schedule from any packet that carries one */
+	if ((currentState == SMAC_STATE_LISTEN_FOR_SCHEDULE)
+			&& fastScheduleAcquisition && macPacket->getCarriesSchedule()
+			&& (macPacket->getType() != SMAC_PACKET_SYNC)) {
+		printInfo("Taking schedule from a non-SYNC packet");
+		acquireSchedule(macPacket);
+		return;
+	}
 
 	if (forUs && (currentState != SMAC_STATE_SLEEP)) {
 		switch (macPacket->getType()) {
 		case SMAC_PACKET_SYNC: {
 			simtime_t syncValue = macPacket->getSyncValue();
+			reportSyncToRouting(macPacket);
 			if (currentState == SMAC_STATE_LISTEN_FOR_SCHEDULE) {
-				cancelTimer(SMAC_TIMER_BS);
-				initialisationComplete = true;
-				adoptSchedule(source, syncValue);
-				broadcastSync();
-				setTimer(SMAC_TIMER_WAKEUP,
-						double(getWakeupTimerValue())/1000.0);
-				/*  don't go to sleep immediately to give the schedule time to
-				 *  rebroadcast before changing radio state                  */
-				setTimer(SMAC_TIMER_WFBSTX, 0.0002);
+				acquireSchedule(macPacket);
 			} else {
-				updateSchedule(source, syncValue);
+				updateSchedule(source, syncValue,
+						macPacket->getScheduleStagger());
+				learnFramePhase(macPacket);
 			}
 			break;
 		}
 		case SMAC_PACKET_RTS : {
 			if (currentState == SMAC_STATE_LISTEN_FOR_RTS) {
 				cancelTimer(SMAC_TIMER_SEND);
-				sendCTS(source, seqNumber);
+				sendCTS(source, seqNumber, macPacket->getNav(),
+						macPacket->getFragmentsToFollow());
 				/* the following two lines are duplicated from sendCTS
 				 * (redundant)                                               */
 				setState(SMAC_STATE_WFDATA);
@@ -989,15 +1784,22 @@ void SMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			if (currentState == SMAC_STATE_WFACK) {
 				cancelTimer(SMAC_TIMER_ACK_TIMEOUT);
 				deleteFrontOfBuffer();
+				if ((--burstFragmentsLeft > 0) && !bufferIsEmpty()) {
+					// next fragment of the burst, under the same reservation
+					sendDataFromFrontOfBuffer();
+					break;
+				}
+				burstFragmentsLeft = 0;
 				if (active) {
 					setState(SMAC_STATE_LISTEN_FOR_RTS);
 					if (!bufferIsEmpty()) {
-						setTimer(SMAC_TIMER_SEND, getRandomSeconds(sendTimerMin,
-								sendTimerMax));
+						setTimer(SMAC_TIMER_SEND, getSendDelay());
 						trace() << "Set SEND timer for "
 								<< getTimer(SMAC_TIMER_SEND)
 								<< "ms";
 					}
+				} else if (adaptiveListening) {
+					startAdaptiveListen();
 				} else {
 					goToSleep();
 					setState(SMAC_STATE_SLEEP);
@@ -1008,19 +1810,39 @@ void SMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			break;
 		}
 		case SMAC_PACKET_DATA : {
-			if (currentState == SMAC_STATE_WFDATA) {
-				cancelTimer(SMAC_TIMER_DATA_TIMEOUT);
+			if (destination == BROADCAST_MAC_ADDRESS) {
+				// not acknowledged, and no handshake to follow
+				collectOutput("Number of broadcast DATA packets received",
+						SELF_MAC_ADDRESS);
 				toNetworkLayer(decapsulatePacket(macPacket));
-				sendAcknowledgement(source, seqNumber);
-				if (active) {
+			} else if (currentState == SMAC_STATE_WFDATA) {
+				cancelTimer(SMAC_TIMER_DATA_TIMEOUT);
+				/* a retransmitted fragment whose ACK was lost: ACK it again,
+				 * but don't pass it up twice                                */
+				if ((source == lastDataSource)
+						&& (seqNumber == lastDataSeqNumber)) {
+					printInfo("Duplicate DATA packet. Not passing it up.");
+				} else {
+					toNetworkLayer(decapsulatePacket(macPacket));
+				}
+				lastDataSource = source;
+				lastDataSeqNumber = seqNumber;
+				sendAcknowledgement(source, seqNumber, macPacket->getNav(),
+						macPacket->getFragmentsToFollow());
+				if (macPacket->getFragmentsToFollow() > 0) {
+					// stay awake for the rest of the burst
+					setState(SMAC_STATE_WFDATA);
+					setTimer(SMAC_TIMER_DATA_TIMEOUT, dataTimeout);
+				} else if (active) {
 					setState(SMAC_STATE_LISTEN_FOR_RTS);
 					if (!bufferIsEmpty()) {
-						setTimer(SMAC_TIMER_SEND, getRandomSeconds(sendTimerMin,
-								sendTimerMax));
+						setTimer(SMAC_TIMER_SEND, getSendDelay());
 						trace() << "Set SEND timer for "
 								<< getTimer(SMAC_TIMER_SEND)
 								<< "ms";
 					}
+				} else if (adaptiveListening) {
+					startAdaptiveListen();
 				} else {
 					setState(SMAC_STATE_SLEEP);
 					goToSleep();
@@ -1031,6 +1853,16 @@ void SMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			}
 			break;
 		}
+		case SMAC_PACKET_PROBE: {
+			if (initialisationComplete && (syncBurstLeft == 0)) {
+				printInfo("Newcomer probing. Sending SYNC burst.");
+				syncBurstLeft = syncBurstLength;
+				setTimer(SMAC_TIMER_SYNC_BURST,
+						getRandomSeconds(syncBroadcastTimeMin,
+								syncBroadcastTimeMax));
+			}
+			break;
+		}
 		default : {
 			printNonFatalError("Received unrecognised packet type. Ignoring.");
 			return;
@@ -1041,10 +1873,31 @@ void SMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 		switch (macPacket->getType()) {
 		case SMAC_PACKET_RTS  : overheardRts = true;  break;
 		case SMAC_PACKET_CTS  : overheardCts = true;  break;
-		case SMAC_PACKET_DATA : overheardRts = false; break;
-		case SMAC_PACKET_ACK  : overheardCts = false; break;
+		case SMAC_PACKET_DATA :
+			overheardRts = (macPacket->getFragmentsToFollow() > 0);  break;
+		case SMAC_PACKET_ACK  :
+			overheardCts = (macPacket->getFragmentsToFollow() > 0);  break;
 		default               : printInfo("Overheard packet");
 		}
+		if ((macPacket->getType() != SMAC_PACKET_SYNC)
+				&& (simTime() + macPacket->getNav() > mediumBusyUntil)) {
+			mediumBusyUntil = simTime() + macPacket->getNav();
+		}
+		/* wake up at the end of the exchange, in case we are the next hop */
+		if (adaptiveListening && (macPacket->getType() != SMAC_PACKET_SYNC)) {
+			setTimer(SMAC_TIMER_ADAPTIVE_LISTEN, SIMTIME_DBL(macPacket->getNav()));
+		}
+		/* nothing for us to do until the end of the exchange (or burst), so
+		 * sleep through it                                                   */
+		bool isBurst = messagePassing
+				&& (macPacket->getFragmentsToFollow() > 1);
+		if ((overhearingAvoidance || isBurst)
+				&& (macPacket->getType() != SMAC_PACKET_SYNC)
+				&& (macPacket->getType() != SMAC_PACKET_ACK)
+				&& (macPacket->getNav() > 0)
+				&& (currentState == SMAC_STATE_LISTEN_FOR_RTS)) {
+			sleepForNav(macPacket->getNav());
+		}
 	} else {
 		printNonFatalError("Packet received from radio layer in wrong state");
 	}
@@ -1076,6 +1929,11 @@ void SMAC::sendRTS(int destination) {
 	rts->setSource(SELF_MAC_ADDRESS);
 	rts->setDestination(destination);
 	rts->setSequenceNumber(currentSequenceNumber);
+	rts->setFrameLevel(frameLevel);
+	/* remainder of the exchange: CTS, then DATA and ACK for each fragment */
+	rts->setFragmentsToFollow(burstFragmentsLeft);
+	rts->setNav(getTxTime(0)+navGuardTime+getBurstNav(burstFragmentsLeft));
+	setScheduleFields(rts);
 
 	setTimer(SMAC_TIMER_CTSREC_TIMEOUT, ctsTimeout);
 
@@ -1097,8 +1955,13 @@ void SMAC::sendRTS(int destination) {
  *                     should be sent.
  *  @param seqNumber   The sequence number contained within the RTS, to which
  *                     the CTS is a response.
+ *  @param rtsNav      The NAV advertised in the RTS, from which the remainder
+ *                     of the exchange after this CTS is worked out.
+ *  @param numFragments Number of DATA fragments the sender has reserved the
+ *                     medium for.
  */
-void SMAC::sendCTS(int destination, int seqNumber) {
+void SMAC::sendCTS(int destination, int seqNumber, simtime_t rtsNav,
+		int numFragments) {
 	trace() << "Sending a CTS to MAC address: " << destination
 			<< ". Sequence number: " << seqNumber;
 
@@ -1109,6 +1972,10 @@ void SMAC::sendCTS(int destination, int seqNumber) {
 	cts->setSource(SELF_MAC_ADDRESS);
 	cts->setDestination(destination);
 	cts->setSequenceNumber(seqNumber);
+	cts->setFrameLevel(frameLevel);
+	cts->setNav(rtsNav-getTxTime(0)-navGuardTime);   // DATA, ACK
+	cts->setFragmentsToFollow(numFragments);
+	setScheduleFields(cts);
 
 	setTimer(SMAC_TIMER_DATA_TIMEOUT, dataTimeout);
 
@@ -1129,8 +1996,13 @@ void SMAC::sendCTS(int destination, int seqNumber) {
  *  @param source    The source of the data packet that we are acknowledging.
  *  @param seqNumber The sequence number of the data packet that we are
  *                   acknowledging.
+ *  @param dataNav   The NAV advertised in the data packet.
+ *  @param fragmentsToFollow Number of fragments of the burst still to come,
+ *                   echoed so that nodes that can hear only us know that the
+ *                   medium is still reserved.
  */
-void SMAC::sendAcknowledgement(int source, int seqNumber) {
+void SMAC::sendAcknowledgement(int source, int seqNumber, simtime_t dataNav,
+		int fragmentsToFollow) {
 	int destination = source;   // (otherwise it gets confusing: we want to
 	                            // send the ack to the source of the data
 	                            // packet)
@@ -1140,6 +2012,10 @@ void SMAC::sendAcknowledgement(int source, int seqNumber) {
 	ack->setType(SMAC_PACKET_ACK);
 	ack->setSource(SELF_MAC_ADDRESS);
 	ack->setDestination(destination);
+	ack->setFrameLevel(frameLevel);
+	ack->setNav(dataNav-getTxTime(0)-navGuardTime);
+	ack->setFragmentsToFollow(fragmentsToFollow);
+	setScheduleFields(ack);
 	printInfo("Sending acknowledgement to radio layer");
 	toRadioLayer(ack);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
@@ -1151,6 +2027,56 @@ int SMAC::handleRadioControlMessage(cMessage*) {
 	return 0;
 }
 
+/**
+ *  Handles control commands from the routing layer. We act on those that
+ *  register a payload to be piggybacked on our SYNCs, and that tell us our
+ *  hop count to the sink (for staggered wakeups, and to advertise on our
+ *  SYNCs); other routing commands are meant for other MAC protocols and are
+ *  ignored.
+ *
+ *  @param msg The command. Deleted by the caller.
+ *  @return 1 if the command was handled; 0 otherwise.
+ */
+int SMAC::handleControlCommand(cMessage* msg) {
+	MacControlMessage* command = dynamic_cast <MacControlMessage*>(msg);
+	if (command == NULL) {
+		printNonFatalError("Unrecognised control command. Ignoring.");
+		return 0;
+	}
+	if (command->getMacControlMessageKind() == MAC_SET_HOPS_TO_SINK) {
+		hopsToSink = command->getHopsToSink();
+		trace() << "Now " << hopsToSink << " hops from the sink";
+		return 1;
+	}
+	if (command->getMacControlMessageKind() != MAC_SET_ROUTING_PAYLOAD)
+		return 1;
+	hasRoutingPayload = true;
+	routingPayload = command->getRoutingPayload();
+	hopsToSink = command->getHopsToSink();
+	trace() << "Routing payload " << routingPayload << " will ride on SYNCs"
+			<< " (" << hopsToSink << " hops to sink)";
+	return 1;
+}
+
+/**
+ *  Tells the routing layer that we have heard a SYNC, and passes up the
+ *  routing payload that it carries (if any), so that the routing layer's
+ *  neighbour table is kept fresh without keep-alives.
+ *
+ *  @param syncPacket The SYNC packet that we received.
+ */
+void SMAC::reportSyncToRouting(SMacPacket* syncPacket) {
+	if (!piggybackRouting) return;
+	MacControlMessage* report =
+			new MacControlMessage("SMAC SYNC heard", MAC_CONTROL_MESSAGE);
+	report->setMacControlMessageKind(MAC_NEIGHBOUR_HEARD);
+	report->setNeighbourMacAddress(syncPacket->getSource());
+	report->setHasRoutingPayload(syncPacket->getHasRoutingPayload());
+	report->setRoutingPayload(syncPacket->getRoutingPayload());
+	report->setHopsToSink(syncPacket->getHopsToSink());
+	toNetworkLayer(report);
+}
+
 /**
  *  Returns true if and only if we have no newly generated sensor readings in
  *  the buffer from the network layer above.
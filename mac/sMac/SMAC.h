@@ -13,21 +13,22 @@
 #include "VirtualMac.h"
 #include "../macBuffer/MacBuffer.h"
 #include "SMacPacket_m.h"
+#include "../macControl/MacControlMessage_m.h"
+#include "ScheduleTable.h"
+#include "../contentionWindow/ContentionWindow.h"
+#include "../radioTiming/RadioTiming.h"
 #include <assert.h>
 #include <string>
-#include <vector>
+#include <map>
 #include "../../CastaliaIncludes.h"
 
 using namespace std;
 
 #define PROTOCOL_NAME "SMAC"
 
-/* Initial size of the schedule table    */
-#define MAX_NODES     32
-
 /* Used for sizing arrays of state and timer names */
-#define SMAC_NUMBER_OF_STATES 9
-#define SMAC_NUMBER_OF_TIMERS 10
+#define SMAC_NUMBER_OF_STATES 10
+#define SMAC_NUMBER_OF_TIMERS 17
 
 /**
  *  State names corresponding to the S-MAC state machine (Dissertation
@@ -44,7 +45,8 @@ enum SmacStates {
 	SMAC_STATE_LISTEN_FOR_RTS,
 	SMAC_STATE_WFDATA,
 	SMAC_STATE_WFCTS,
-	SMAC_STATE_WFACK
+	SMAC_STATE_WFACK,
+	SMAC_STATE_NAV_SLEEP
 };
 
 /**
@@ -62,7 +64,14 @@ enum SmacTimers {
 	SMAC_TIMER_CTSREC_TIMEOUT,
 	SMAC_TIMER_DATA_TIMEOUT,
 	SMAC_TIMER_ACK_TIMEOUT,
-	SMAC_TIMER_WFBSTX
+	SMAC_TIMER_WFBSTX,
+	SMAC_TIMER_ADAPTIVE_LISTEN,
+	SMAC_TIMER_NAV,
+	SMAC_TIMER_SECONDARY_WAKEUP,
+	SMAC_TIMER_BROADCAST_DATA,
+	SMAC_TIMER_PROBE,
+	SMAC_TIMER_SYNC_BURST,
+	SMAC_TIMER_CONTENTION_DEFERRED
 };
 
 /**
@@ -75,11 +84,14 @@ private:
 	double phyDelayForValidCS;
 	double phyDataRate;
 	int phyFrameOverhead;
+	RadioTiming* radioTiming;
 
 	bool sendDataEnabled;
 
 	double syncListenPeriod;
 	double rtsListenPeriod;
+	double listenPeriod;   // sync and RTS listen periods together
+	int maxFollowedSchedules;
 	double listenSleepPeriod;
 
 	double minInitialScheduleWaitTime;
@@ -87,6 +99,23 @@ private:
 
 	int sendTimerMin;
 	int sendTimerMax;
+
+	bool adaptiveListening;
+	double adaptiveListenPeriod;
+	double navGuardTime;
+
+	bool overhearingAvoidance;
+
+	bool messagePassing;
+	int maxBurstFragments;
+
+	int maxFrameLevel;
+	int idleFramesBeforeStretch;
+
+	double syncGuardTime;
+	int maxScountMultiplier;
+
+	bool slottedContention;
 	/* end parameters from .ned file */
 
 	/* begin state machine control */
@@ -108,6 +137,13 @@ private:
 	void handleDataTimeoutCallback();
 	void handleAckTimeoutCallback();
 	void handleWfBsTxTimerCallback();
+	void handleAdaptiveListenTimerCallback();
+	void handleNavTimerCallback();
+	void handleSecondaryWakeupTimerCallback();
+	void handleBroadcastDataTimerCallback();
+	void handleProbeTimerCallback();
+	void handleSyncBurstTimerCallback();
+	void handleContentionDeferredTimerCallback();
 	/* end timer callback functions */
 
 	/* random generation */
@@ -121,13 +157,28 @@ private:
 	void sendBufferedDataPacket();     // initiates handshake
 	void sendDataFromFrontOfBuffer();  // actually sends the thing
 	int numRetries;
+	int burstFragmentsLeft;   // including the one in flight
+	simtime_t getBurstNav(int numFragments);
+	void sendBroadcastData();   // no handshake or ACK
+	ContentionWindow* contentionWindow;
+	double getSendDelay();
+	simtime_t mediumBusyUntil;   // end of the latest overheard NAV
+	bool isMediumBusy();
+	void deferContention();
 	/* end sending data functions and state */
 
+	/* begin receiving data state */
+	int lastDataSource;
+	int lastDataSeqNumber;
+	/* end receiving data state */
+
 	/* packet manipulation functions */
 	void broadcastSync();
 	void sendRTS(int destination);
-	void sendCTS(int destination, int seqNumber);
-	void sendAcknowledgement(int source, int seqNumber);
+	void sendCTS(int destination, int seqNumber, simtime_t rtsNav,
+			int numFragments);
+	void sendAcknowledgement(int source, int seqNumber, simtime_t dataNav,
+			int fragmentsToFollow);
 	/* end packet manipulation functions */
 
 	/* timeout state */
@@ -148,8 +199,50 @@ private:
 	/* begin power control functions */
 	void goToSleep();
 	void wakeUp();
+	void sleepForNav(simtime_t nav);
 	/* end power control functions */
 
+	/* begin adaptive listening functions and state */
+	bool inAdaptiveListen;
+	void startAdaptiveListen();
+	double getAdaptiveSendDelay();
+	double getTxTime(int numBytes);   // airtime in seconds
+	/* end adaptive listening functions and state */
+
+	/* begin traffic-adaptive frame length functions and state */
+	int frameLevel;          // frame is listenSleepPeriod*2^frameLevel long
+	int framePhase;          // added to frame indices to align with neighbours
+	int framePhaseSource;    // MAC address from which the phase originated
+	bool trafficThisFrame;
+	int idleFrames;
+	map<int, int> neighbourFrameLevels;
+	void noteTraffic();
+	void adaptFrameLength();
+	void learnFrameLevel(SMacPacket* macPacket);
+	void learnFramePhase(SMacPacket* macPacket);
+	int getNextFrame();
+	int getSuperframePosition(int frame);
+	bool isAwakeInCurrentFrame(int macAddress);
+	/* end traffic-adaptive frame length functions and state */
+
+	/* begin routing piggyback state and functions */
+	bool piggybackRouting;     // from .ned file
+	bool hasRoutingPayload;    // set once the routing layer registers one
+	int routingPayload;        // carried on our SYNCs
+	void reportSyncToRouting(SMacPacket* syncPacket);
+	/* end routing piggyback state and functions */
+
+	/* begin staggered wakeup state and functions */
+	bool staggeredWakeup;
+	double staggerSlotTime;
+	int maxStaggerDepth;
+	int hopsToSink;             // from the routing layer, -1 if unknown
+	simtime_t appliedStagger;   // shift of primarySchedule from our cluster's
+	simtime_t getStagger(int hops);
+	void applyStagger();
+	double getWaitForDestination(int destination);
+	/* end staggered wakeup state and functions */
+
 	int syncBroadcastTimeMin;
 	int syncBroadcastTimeMax;
 
@@ -164,39 +257,54 @@ private:
 	bool active;
 	simtime_t primarySchedule;
 	simtime_t constOverhead;
-	std::vector<simtime_t> scheduleTable;  // indexed by MAC address
-	void addSchedule(int source, simtime_t value);   // value is from the sync packet
-	inline void updateSchedule(int source, simtime_t value) { addSchedule(source, value); };
+	ScheduleTable* scheduleTable;  // keyed by MAC address, neighbours only
+	void addSchedule(int source, simtime_t value, simtime_t sourceStagger);   // values are from the sync packet
+	inline void updateSchedule(int source, simtime_t value, simtime_t sourceStagger) { addSchedule(source, value, sourceStagger); };
 	simtime_t getScheduleValue();   // (for broadcasting)
-	simtime_t getMaxScheduleTableOffset();
-	simtime_t getMinScheduleTableOffset();
-	inline simtime_t getLargestOffset() {return getMaxScheduleTableOffset();};
-	inline simtime_t getSmallestOffset() {return getMinScheduleTableOffset();};
+	vector<ListenWindow> listenWindows;   // relative to our frame, ours first
+	void updateListenWindows();
+	bool isInWindow(int macAddress, int window);
 	void printScheduleTable();
 	double getListenTimeoutValue();
 	double getWakeupTimerValue();
 	void adoptSchedule(int source, simtime_t value);  // used initially
 	void createSchedule();   // used if no schedule to be adopted
+	void acquireSchedule(SMacPacket* macPacket);   // adopt and rebroadcast
 	/* end schedule management */
 
+	/* begin fast schedule acquisition state and functions */
+	bool fastScheduleAcquisition;
+	double probeInterval;
+	int syncBurstLength;
+	int syncBurstLeft;
+	void sendProbe();
+	void setScheduleFields(SMacPacket* macPacket);
+	/* end fast schedule acquisition state and functions */
+
 	int currentSequenceNumber;
 	int scount;
-	int numWakeups;
+	int scountMultiplier;   // SYNC interval stretch, from drift estimates
+	void adaptSyncInterval();
+	int currentFrame;   // index of the base frame we last woke up for
+	int nextFrame;      // index of the base frame we will next wake up for
 	int sinkMacAddress;
 	bool isSink;
 	bool initialisationComplete;
 	const static int maxRetries = 5;
 
 	MacBuffer<SMacPacket*>* macBuffer;
+	MacBuffer<SMacPacket*>* broadcastBuffer;   // kept apart, as not handshaked
 
 
 protected:
 	void startup();
 	void reset();
+	void finishSpecific();
 	void timerFiredCallback(int);
 	void fromNetworkLayer(cPacket *, int);
 	void fromRadioLayer(cPacket *, double, double);
 	int handleRadioControlMessage(cMessage *);
+	int handleControlCommand(cMessage *);
 };
 
 /**
@@ -211,7 +319,8 @@ const string SMAC::SmacStateNames [SMAC_NUMBER_OF_STATES] = {
 		"SMAC_STATE_LISTEN_FOR_RTS",
 		"SMAC_STATE_WFDATA",
 		"SMAC_STATE_WFCTS",
-		"SMAC_STATE_WFACK" };
+		"SMAC_STATE_WFACK",
+		"SMAC_STATE_NAV_SLEEP" };
 
 /**
  *  Human-friendly names of the timers used in the S-MAC protocol.
@@ -226,6 +335,13 @@ const string SMAC::SmacTimerNames [SMAC_NUMBER_OF_TIMERS] = {
 		"SMAC_TIMER_CTSREC_TIMEOUT",
 		"SMAC_TIMER_DATA_TIMEOUT",
 		"SMAC_TIMER_ACK_TIMEOUT",
-		"SMAC_TIMER_WFBSTX" };
+		"SMAC_TIMER_WFBSTX",
+		"SMAC_TIMER_ADAPTIVE_LISTEN",
+		"SMAC_TIMER_NAV",
+		"SMAC_TIMER_SECONDARY_WAKEUP",
+		"SMAC_TIMER_BROADCAST_DATA",
+		"SMAC_TIMER_PROBE",
+		"SMAC_TIMER_SYNC_BURST",
+		"SMAC_TIMER_CONTENTION_DEFERRED" };
 
 #endif /* def SMAC_H_ */
@@ -0,0 +1,281 @@
+/**
+ *  ScheduleTable.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Offsets of neighbouring nodes' schedules from our own primary schedule,
+ *  for use in the S-MAC protocol.
+ *
+ */
+
+#include "ScheduleTable.h"
+#include <cmath>
+#include <algorithm>
+
+/* a listen window while it is being built, with the number of schedules
+ * (including repeats) that it covers                                      */
+struct MergedWindow {
+	simtime_t start;
+	simtime_t end;
+	int numSchedules;
+};
+
+static bool coversMoreSchedules(const MergedWindow& a, const MergedWindow& b) {
+	return a.numSchedules > b.numSchedules;
+}
+
+static bool startsEarlier(const MergedWindow& a, const MergedWindow& b) {
+	return a.start < b.start;
+}
+
+ScheduleTable::ScheduleTable() : base(0), cachedWindowsValid(false) {}
+
+ScheduleTable::~ScheduleTable() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Sets the offset of the station with the given MAC address, adding the
+ *  station to the table if we have not heard from it before. Only the old
+ *  value of that entry is removed from the ordered copy, so the update costs
+ *  O(log n) in the number of neighbours.
+ */
+void ScheduleTable::update(const int macAddress, simtime_t offset) {
+	simtime_t stored = offset+base;
+	map<int, simtime_t>::iterator it = offsets.find(macAddress);
+	if (it == offsets.end()) {
+		offsets.insert(make_pair(macAddress, stored));
+	} else {
+		sortedOffsets.erase(sortedOffsets.find(it->second));
+		it->second = stored;
+	}
+	sortedOffsets.insert(stored);
+	cachedWindowsValid = false;
+}
+
+/**
+ *  Subtracts the given amount from every offset in the table. Used when our
+ *  primary schedule is moved. Since entries are stored relative to the base
+ *  epoch, this is constant-time: only the base is moved.
+ */
+void ScheduleTable::reduceAll(simtime_t reductionAmount) {
+	base += reductionAmount;
+	cachedWindowsValid = false;
+}
+
+bool ScheduleTable::contains(const int macAddress) const {
+	return (offsets.find(macAddress) != offsets.end());
+}
+
+/**
+ *  @return The offset of the given station, or 0 (i.e. our own schedule) if
+ *          we have not heard from it.
+ */
+simtime_t ScheduleTable::getOffset(const int macAddress) const {
+	const_iterator it = offsets.find(macAddress);
+	if (it == offsets.end()) {
+		simtime_t zero = 0;
+		return zero;
+	}
+	return it->second-base;
+}
+
+/**
+ *  @return The largest offset in the table, including our own offset of 0.
+ */
+simtime_t ScheduleTable::getMaxOffset() const {
+	simtime_t zero = 0;
+	if (sortedOffsets.empty()) return zero;
+	simtime_t largest = *sortedOffsets.rbegin()-base;
+	return (largest > zero) ? largest : zero;
+}
+
+/**
+ *  @return The smallest offset in the table, including our own offset of 0.
+ */
+simtime_t ScheduleTable::getMinOffset() const {
+	simtime_t zero = 0;
+	if (sortedOffsets.empty()) return zero;
+	simtime_t smallest = *sortedOffsets.begin()-base;
+	return (smallest < zero) ? smallest : zero;
+}
+
+/**
+ *  Records the phase of a neighbour's schedule, as given by its latest SYNC,
+ *  and updates our estimate of its drift. The phase may be the time of any
+ *  of its frames, since the change since the last SYNC is taken modulo the
+ *  frame period. Successive estimates are averaged, to smooth out jitter in
+ *  the SYNC timestamps.
+ *
+ *  @param macAddress The neighbour's MAC address.
+ *  @param phase      Absolute time (on our clock) of one of its frames.
+ *  @param period     The base frame period.
+ *  @param now        The current time on our clock.
+ */
+void ScheduleTable::recordPhase(const int macAddress, simtime_t phase,
+		simtime_t period, simtime_t now) {
+	map<int, PhaseRecord>::iterator it = phases.find(macAddress);
+	if (it == phases.end()) {
+		PhaseRecord record;
+		record.phase = phase;
+		record.heardAt = now;
+		record.driftRate = 0;
+		record.hasDriftRate = false;
+		phases.insert(make_pair(macAddress, record));
+		return;
+	}
+
+	PhaseRecord& record = it->second;
+	simtime_t elapsed = now-record.heardAt;
+	if (elapsed <= 0) return;
+
+	// change in phase, wrapped into (-period/2, period/2]
+	simtime_t change = phase-record.phase;
+	change -= period*floor(change/period+0.5);
+
+	double sample = change/elapsed;
+	if (record.hasDriftRate) {
+		record.driftRate = 0.5*record.driftRate + 0.5*sample;
+	} else {
+		record.driftRate = sample;
+		record.hasDriftRate = true;
+	}
+	record.phase = phase;
+	record.heardAt = now;
+}
+
+/**
+ *  @return The estimated drift of the given neighbour's clock relative to
+ *          ours (seconds per second), or 0 if we do not have an estimate.
+ */
+double ScheduleTable::getDriftRate(const int macAddress) const {
+	map<int, PhaseRecord>::const_iterator it = phases.find(macAddress);
+	if ((it == phases.end()) || !it->second.hasDriftRate) return 0;
+	return it->second.driftRate;
+}
+
+/**
+ *  @return The largest magnitude of drift rate of any neighbour, or 0 if we
+ *          do not yet have any estimates. Scans the table, but is only needed
+ *          once per SYNC broadcast.
+ */
+double ScheduleTable::getMaxDriftRate() const {
+	double largest = 0;
+	map<int, PhaseRecord>::const_iterator it;
+	for (it = phases.begin(); it != phases.end(); ++it) {
+		if (it->second.hasDriftRate && (fabs(it->second.driftRate) > largest)) {
+			largest = fabs(it->second.driftRate);
+		}
+	}
+	return largest;
+}
+
+/**
+ *  @return True if we have a drift estimate for at least one neighbour.
+ */
+bool ScheduleTable::hasDriftRates() const {
+	map<int, PhaseRecord>::const_iterator it;
+	for (it = phases.begin(); it != phases.end(); ++it) {
+		if (it->second.hasDriftRate) return true;
+	}
+	return false;
+}
+
+/**
+ *  Works out when we need to listen during each frame in order to overlap
+ *  with the listen period of every schedule in the table (and our own).
+ *  Listen periods that overlap, including across the end of the frame, are
+ *  merged into a single window, so that we sleep in between windows rather
+ *  than staying awake from the first to the last.
+ *
+ *  The first window returned is always the one containing our own listen
+ *  period (it may start before our frame does, i.e. at a negative offset).
+ *  The others, if any, follow it in order of start time. At most maxWindows
+ *  are returned: where there are more, the ones followed by the most
+ *  neighbours are kept.
+ *
+ *  @param listenPeriod Length of each schedule's listen period.
+ *  @param framePeriod  Length of a frame.
+ *  @param maxWindows   Largest number of windows to follow (at least 1).
+ *  @param windows      Cleared, then filled with the windows, relative to the
+ *                      start of our frame.
+ */
+void ScheduleTable::getListenWindows(simtime_t listenPeriod,
+		simtime_t framePeriod, int maxWindows,
+		vector<ListenWindow>& windows) const {
+	if (!cachedWindowsValid || (listenPeriod != cachedListenPeriod)
+			|| (framePeriod != cachedFramePeriod)
+			|| (maxWindows != cachedMaxWindows)) {
+		buildListenWindows(listenPeriod, framePeriod, maxWindows,
+				cachedWindows);
+		cachedListenPeriod = listenPeriod;
+		cachedFramePeriod = framePeriod;
+		cachedMaxWindows = maxWindows;
+		cachedWindowsValid = true;
+	}
+	windows = cachedWindows;
+}
+
+/**
+ *  Does the work of getListenWindows(), without the cache.
+ */
+void ScheduleTable::buildListenWindows(simtime_t listenPeriod,
+		simtime_t framePeriod, int maxWindows,
+		vector<ListenWindow>& windows) const {
+	// start of each schedule's listen period within our frame
+	vector<simtime_t> starts;
+	starts.push_back(0);   // our own schedule
+	multiset<simtime_t>::const_iterator it;
+	for (it = sortedOffsets.begin(); it != sortedOffsets.end(); ++it) {
+		simtime_t start = *it-base;
+		start -= framePeriod*floor(start/framePeriod);
+		starts.push_back(start);
+	}
+	sort(starts.begin(), starts.end());
+
+	vector<MergedWindow> merged;
+	vector<simtime_t>::iterator s;
+	for (s = starts.begin(); s != starts.end(); ++s) {
+		if (!merged.empty() && (*s <= merged.back().end)) {
+			if (*s+listenPeriod > merged.back().end) {
+				merged.back().end = *s+listenPeriod;
+			}
+			merged.back().numSchedules++;
+		} else {
+			MergedWindow window;
+			window.start = *s;
+			window.end = *s+listenPeriod;
+			window.numSchedules = 1;
+			merged.push_back(window);
+		}
+	}
+
+	// windows running past the end of the frame into our own listen period
+	while ((merged.size() > 1)
+			&& (merged.back().end >= merged.front().start+framePeriod)) {
+		MergedWindow& first = merged.front();
+		first.start = merged.back().start-framePeriod;
+		if (merged.back().end-framePeriod > first.end) {
+			first.end = merged.back().end-framePeriod;
+		}
+		first.numSchedules += merged.back().numSchedules;
+		merged.pop_back();
+		while ((merged.size() > 1) && (merged[1].start <= first.end)) {
+			if (merged[1].end > first.end) first.end = merged[1].end;
+			first.numSchedules += merged[1].numSchedules;
+			merged.erase(merged.begin()+1);
+		}
+	}
+
+	// keep our own window, and the busiest of the others
+	if ((int)merged.size() > maxWindows) {
+		stable_sort(merged.begin()+1, merged.end(), coversMoreSchedules);
+		merged.resize(maxWindows > 1 ? maxWindows : 1);
+		sort(merged.begin()+1, merged.end(), startsEarlier);
+	}
+
+	windows.clear();
+	vector<MergedWindow>::iterator w;
+	for (w = merged.begin(); w != merged.end(); ++w) {
+		windows.push_back(make_pair(w->start, w->end));
+	}
+}
@@ -0,0 +1,88 @@
+/**
+ *  ScheduleTable.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Offsets of neighbouring nodes' schedules from our own primary schedule,
+ *  for use in the S-MAC protocol. Only neighbours that we have actually heard
+ *  a SYNC from are stored, so memory is proportional to the node's degree
+ *  rather than to the size of the network, and there is no ceiling on MAC
+ *  addresses. As well as the table itself, an ordered copy of the offsets is
+ *  maintained as entries are updated, so that the largest and smallest
+ *  offsets can be read on every wakeup and sleep without scanning the table.
+ *
+ *  Our own schedule always has an offset of 0 and is implicitly part of the
+ *  table.
+ *
+ *  Entries are stored relative to a shared base epoch rather than to our
+ *  primary schedule directly, so moving the primary schedule (which shifts
+ *  every offset by the same amount) only adjusts the base.
+ *
+ *  Border nodes, whose neighbours follow different schedules, listen in
+ *  several windows per frame: getListenWindows() merges the listen periods of
+ *  all the schedules in the table into a small set of windows. The windows
+ *  are cached, and only worked out again once the table has changed (or
+ *  they are asked for with different parameters), since they are needed
+ *  twice per frame but the table only changes when a SYNC is heard.
+ *
+ *  The table also keeps an estimate of each neighbour's clock drift relative
+ *  to ours, from the change in phase of its schedule between successive
+ *  SYNCs, so that SYNCs need only be sent as often as drift requires.
+ *
+ */
+
+#ifndef SCHEDULETABLE_H_
+#define SCHEDULETABLE_H_
+
+#include <map>
+#include <set>
+#include <vector>
+#include "VirtualMac.h"
+
+using namespace std;
+
+struct PhaseRecord {
+	simtime_t phase;      // absolute time of one of the neighbour's frames
+	simtime_t heardAt;    // when the phase was recorded
+	double driftRate;     // seconds per second, relative to our clock
+	bool hasDriftRate;    // false until two phases have been recorded
+};
+
+typedef pair<simtime_t, simtime_t> ListenWindow;   // start and end of window
+
+class ScheduleTable {
+private:
+	map<int, simtime_t> offsets;        // keyed by MAC address, relative to base
+	multiset<simtime_t> sortedOffsets;  // the same values, kept in order
+	simtime_t base;                     // subtract to get the real offset
+	map<int, PhaseRecord> phases;       // keyed by MAC address
+
+	/* cache of the last result of getListenWindows() */
+	mutable vector<ListenWindow> cachedWindows;
+	mutable bool cachedWindowsValid;
+	mutable simtime_t cachedListenPeriod, cachedFramePeriod;
+	mutable int cachedMaxWindows;
+	void buildListenWindows(simtime_t listenPeriod, simtime_t framePeriod,
+			int maxWindows, vector<ListenWindow>& windows) const;
+public:
+	typedef map<int, simtime_t>::const_iterator const_iterator;  // use getOffset() on ->first
+	ScheduleTable();
+	virtual ~ScheduleTable();
+	void update(const int macAddress, simtime_t offset);
+	void reduceAll(simtime_t reductionAmount);
+	bool contains(const int macAddress) const;
+	simtime_t getOffset(const int macAddress) const;
+	simtime_t getMaxOffset() const;
+	simtime_t getMinOffset() const;
+	void recordPhase(const int macAddress, simtime_t phase, simtime_t period,
+			simtime_t now);
+	double getDriftRate(const int macAddress) const;
+	double getMaxDriftRate() const;
+	bool hasDriftRates() const;
+	void getListenWindows(simtime_t listenPeriod, simtime_t framePeriod,
+			int maxWindows, vector<ListenWindow>& windows) const;
+	inline int size() const { return offsets.size(); };
+	inline const_iterator begin() const { return offsets.begin(); };
+	inline const_iterator end() const { return offsets.end(); };
+};
+
+#endif /* SCHEDULETABLE_H_ */
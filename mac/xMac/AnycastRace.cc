@@ -0,0 +1,72 @@
+/**
+ *  AnycastRace.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  The race between neighbours that acknowledge the same anycast preamble,
+ *  for use in the X-MAC protocol.
+ *
+ */
+
+#include "AnycastRace.h"
+
+AnycastRace::AnycastRace() {
+	source = ANYCAST_NO_RACE;
+	ackPending = false;
+}
+
+AnycastRace::~AnycastRace() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Called when we decide to take an anycast preamble, which other forwarders
+ *  may take too. Our ACK is pending until ackSent() is called. Replaces any
+ *  earlier race.
+ */
+void AnycastRace::enter(int preambleSource) {
+	source = preambleSource;
+	ackPending = true;
+}
+
+/**
+ *  Called when our preamble ACK is sent, after which we can no longer tell
+ *  from another forwarder's ACK which of us the sender heard first.
+ */
+void AnycastRace::ackSent() {
+	ackPending = false;
+}
+
+/**
+ *  @param dataSource      Sender of an overheard DATA packet.
+ *  @param dataDestination Its destination.
+ *  @param ourAddress      Our MAC address.
+ *  @return True if we are in a race, and the DATA shows that the sender
+ *          chose another forwarder.
+ */
+bool AnycastRace::isLostTo(int dataSource, int dataDestination,
+		int ourAddress) const {
+	return inRace() && (dataSource == source)
+			&& (dataDestination != ourAddress);
+}
+
+/**
+ *  @param ackSource      Sender of an overheard preamble ACK.
+ *  @param ackDestination Its destination.
+ *  @param ourAddress     Our MAC address.
+ *  @return True if our ACK is still pending, and another forwarder has
+ *          acknowledged the same preamble first.
+ */
+bool AnycastRace::isBeatenBy(int ackSource, int ackDestination,
+		int ourAddress) const {
+	return isAckPending() && (ackDestination == source)
+			&& (ackSource != ourAddress);
+}
+
+/**
+ *  Called once the race is decided: we received the DATA, overheard it go
+ *  elsewhere, or gave up waiting for it.
+ */
+void AnycastRace::leave() {
+	source = ANYCAST_NO_RACE;
+	ackPending = false;
+}
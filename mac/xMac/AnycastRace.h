@@ -0,0 +1,39 @@
+/**
+ *  AnycastRace.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  The race between neighbours that acknowledge the same anycast preamble,
+ *  for use in the X-MAC protocol. Every eligible forwarder that wakes up
+ *  during a strobe train may acknowledge it, but the sender only sends the
+ *  DATA to the first one it hears from. The others have lost, and must go
+ *  back to sleep rather than wait for the DATA: either when they overhear it
+ *  go to the winner, or when it doesn't come in time. Forwarders wait a
+ *  random slot before acknowledging, so that their ACKs don't collide, and
+ *  one that overhears another forwarder's ACK while still waiting has lost
+ *  without sending its own.
+ *
+ */
+
+#ifndef ANYCASTRACE_H_
+#define ANYCASTRACE_H_
+
+#define ANYCAST_NO_RACE -1
+
+class AnycastRace {
+private:
+	int source;        // whose anycast preamble we took
+	bool ackPending;   // our preamble ACK has not been sent yet
+public:
+	AnycastRace();
+	virtual ~AnycastRace();
+	void enter(int preambleSource);
+	void ackSent();
+	bool isLostTo(int dataSource, int dataDestination, int ourAddress) const;
+	bool isBeatenBy(int ackSource, int ackDestination, int ourAddress) const;
+	void leave();
+	inline bool inRace() const { return (source != ANYCAST_NO_RACE); };
+	inline bool isAckPending() const { return inRace() && ackPending; };
+	inline int getSource() const { return source; };
+};
+
+#endif /* ANYCASTRACE_H_ */
@@ -0,0 +1,70 @@
+/**
+ *  PhaseTable.cc
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Wakeup schedules of neighbouring nodes, for use in the X-MAC protocol.
+ *
+ */
+
+#include "PhaseTable.h"
+#include <cmath>
+
+PhaseTable::PhaseTable(double driftRate, simtime_t minGuard) {
+	this->driftRate = driftRate;
+	this->minGuard = minGuard;
+}
+
+PhaseTable::~PhaseTable() {
+	// everything's on the stack - nothing to do here :)
+}
+
+/**
+ *  Records a neighbour's wakeup schedule, replacing any previous one.
+ *
+ *  @param wakeup   Absolute time at which the neighbour will next wake up.
+ *  @param interval Time between the neighbour's wakeups.
+ *  @param now      Current time.
+ */
+void PhaseTable::update(const int macAddress, simtime_t wakeup,
+		simtime_t interval, simtime_t now) {
+	PhaseEntry entry;
+	entry.wakeup = wakeup;
+	entry.interval = interval;
+	entry.heardAt = now;
+	phases[macAddress] = entry;
+}
+
+void PhaseTable::remove(const int macAddress) {
+	phases.erase(macAddress);
+}
+
+bool PhaseTable::contains(const int macAddress) const {
+	return (phases.find(macAddress) != phases.end());
+}
+
+/**
+ *  Predicts when a neighbour will next wake up.
+ *
+ *  @param wakeup Set to the first of the neighbour's wakeups that is not
+ *                before now.
+ *  @param guard  Set to how long before (or after) the predicted time it might
+ *                in fact wake up.
+ *  @return False if the neighbour's schedule is unknown, or has become too
+ *          uncertain to be of use, in which case wakeup and guard are not set.
+ */
+bool PhaseTable::predict(const int macAddress, simtime_t now,
+		simtime_t& wakeup, simtime_t& guard) const {
+	map<int, PhaseEntry>::const_iterator it = phases.find(macAddress);
+	if ((it == phases.end()) || (it->second.interval <= 0))
+		return false;
+	const PhaseEntry& entry = it->second;
+	simtime_t next = entry.wakeup;
+	if (next < now)
+		next += entry.interval*ceil((now - next)/entry.interval);
+	simtime_t nextGuard = minGuard + 4*driftRate*(next - entry.heardAt);
+	if (nextGuard*2 >= entry.interval)
+		return false;
+	wakeup = next;
+	guard = nextGuard;
+	return true;
+}
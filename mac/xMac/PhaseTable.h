@@ -0,0 +1,52 @@
+/**
+ *  PhaseTable.h
+ *  Matthew Ireland, mti20, University of Cambridge
+ *
+ *  Wakeup schedules of neighbouring nodes, for use in the X-MAC protocol (as
+ *  in WiseMAC). Every preamble ACK and ACK says how long it will be until its
+ *  sender next wakes up, and how often it wakes up, so a node that has sent
+ *  data to a neighbour can predict the neighbour's later wakeups, and start
+ *  strobing just before one of them instead of for a whole check period.
+ *
+ *  Since clocks drift, the prediction becomes less certain the longer it has
+ *  been since we last heard from the neighbour. Strobing starts a guard time
+ *  before the predicted wakeup, of 4*driftRate*(time since last heard): each
+ *  of the two clocks may have drifted by driftRate*(time since last heard),
+ *  in either direction. Once the guard time reaches half of the neighbour's
+ *  wakeup interval the prediction is no better than none, and no prediction
+ *  is made.
+ *
+ */
+
+#ifndef PHASETABLE_H_
+#define PHASETABLE_H_
+
+#include <map>
+#include "VirtualMac.h"
+
+using namespace std;
+
+struct PhaseEntry {
+	simtime_t wakeup;     // absolute time of one of the neighbour's wakeups
+	simtime_t interval;   // between the neighbour's wakeups
+	simtime_t heardAt;    // when the above were learnt
+};
+
+class PhaseTable {
+private:
+	map<int, PhaseEntry> phases;   // keyed by MAC address
+	double driftRate;              // largest clock drift, seconds per second
+	simtime_t minGuard;            // guard time straight after hearing from it
+public:
+	PhaseTable(double driftRate, simtime_t minGuard);
+	virtual ~PhaseTable();
+	void update(const int macAddress, simtime_t wakeup, simtime_t interval,
+			simtime_t now);
+	void remove(const int macAddress);
+	bool contains(const int macAddress) const;
+	bool predict(const int macAddress, simtime_t now, simtime_t& wakeup,
+			simtime_t& guard) const;
+	inline int size() const { return phases.size(); };
+};
+
+#endif /* PHASETABLE_H_ */
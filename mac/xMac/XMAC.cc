@@ -9,6 +9,7 @@
 #include "../../CastaliaIncludes.h"
 #include "../macBuffer/MacBuffer.h"
 #include <cstdlib>
+#include <cmath>
 
 Define_Module(XMAC);
 
@@ -28,19 +29,38 @@ void XMAC::startup() {
 	phyDataRate           = par("phyDataRate");
 	phyFrameOverhead      = par("phyFrameOverhead");
 
-	wakeupDelay           = par("wakeupDelay");
+	radioTiming = RadioTiming::create(par("phyRadio").stdstringValue(),
+			phyDataRate, phyFrameOverhead, par("phyTurnaroundTime"),
+			par("wakeupDelay"));
+	wakeupDelay           = radioTiming->getWakeupDelay();
 
 	listenPeriod          = par("listenPeriod");
 	interAckPeriod        = par("interAckPeriod");
 	interPreamblePeriod   = interAckPeriod;   // the above was just a silly name for this
+
+	// the gap between strobes must leave time for the receiver to turn round
+	// and send a preamble ACK, and for us to turn round again to hear it
+	int macPacketOverhead = par("macPacketOverhead");
+	double minInterPreamblePeriod = 2*(radioTiming->getTxTime(macPacketOverhead)
+			+ radioTiming->getTurnaroundTime());
+	if (interPreamblePeriod < minInterPreamblePeriod) {
+		printNonFatalError("interAckPeriod too short for a preamble ACK. Using the shortest possible instead.");
+		interPreamblePeriod = minInterPreamblePeriod;
+	}
 	checkPeriod           = par("checkPeriod");
 	maxDataDelay          = par("maxDataDelay");
 	maxDataSendDelay      = par("maxDataSendDelay");
 	maxBroadcastDataDelay = par("maxBroadcastDataDelay");
 
+	packetTrains          = par("packetTrains");
+	sentMoreData          = false;
+	moreDataExpected      = false;
+
 	sinkMacAddress        = par("sinkMacAddress");
+	alwaysOn = par("sinkAlwaysOn") && (SELF_MAC_ADDRESS == sinkMacAddress);
 
 	numberOfPreambles     = par("numberOfPreambles");
+	preamblesThisTrain    = numberOfPreambles;
 	retryPeriod           = par("retryPeriod");
 
 	waitForAckTxTime      = par("waitForAckTxTime");
@@ -60,6 +80,10 @@ void XMAC::startup() {
 	declareOutput("Number of preamble acks received");
 	declareOutput("Number of DATA packets received");
 	declareOutput("Number of acks received");
+	declareOutput("Number of preambles skipped");   // destination always on
+	declareOutput("Number of preambles shortened"); // destination's phase known
+	declareOutput("Number of anycast preambles taken");
+	declareOutput("Number of anycast preambles lost before acking");
 
 	// initialise internal state
 	currentSequenceNumber = 0;
@@ -69,9 +93,41 @@ void XMAC::startup() {
 
 	macBuffer = new MacBuffer<XMacPacket*>(this, 25, true);
 
+	adaptiveDutyCycle     = par("adaptiveDutyCycle");
+	maxCheckLevel         = adaptiveDutyCycle ? (int)par("maxCheckLevel") : 0;
+	loadAlpha             = par("loadAlpha");
+	targetPacketsPerCheck = par("targetPacketsPerCheck");
+	baseCheckPeriod       = checkPeriod;
+	checkLevel            = 0;
+	offeredLoad           = 0;
+	packetsThisCheck      = 0;
+	lastLoadUpdate        = simTime();
+
+	anycast          = par("anycast");
+	anycastThisTrain = false;
+	hopsToSink       = (SELF_MAC_ADDRESS == sinkMacAddress) ? 0 : -1;
+	anycastRace.leave();
+
+	// forwarders acknowledge an anycast preamble in a random slot of the gap
+	// before the next strobe; each slot leaves time for a later forwarder to
+	// hear the ACK sent in an earlier one and turn round
+	int ackLength = par("macPacketOverhead");
+	anycastAckSlotTime = radioTiming->getTxTime(ackLength)
+			+ 2*radioTiming->getTurnaroundTime();
+	anycastAckSlots = (int)((interPreamblePeriod
+			- radioTiming->getTxTime(ackLength))/anycastAckSlotTime);
+	if (anycastAckSlots < 1)
+		anycastAckSlots = 1;
+
+	phaseLearning  = par("phaseLearning");
+	phaseTable     = new PhaseTable(par("maxClockDrift"), interPreamblePeriod);
+	phaseWaitDone  = false;
+	wakeupInterval = checkPeriod + listenPeriod;
+	wakeupOrigin   = simTime() + checkPeriod;
+
 	// ready, set, go!
 	goToSleep();
-	setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+	scheduleCheck();
 
 	printInfo("startup complete");
 }
@@ -88,19 +144,24 @@ void XMAC::timerFiredCallback(int timer) {
 	case XMAC_TIMER_PREAMBLESTROBE: handlePreambleTimerCallback();    break;
 	case XMAC_TIMER_RETRY: handleRetryTimerCallback();    break;
 	case XMAC_TIMER_RETRYWAKEUP: handleRetryWakeupTimerCallback();    break;
-	case XMAC_TIMER_WAITFORACKTX: goToSleep(); break;
+	case XMAC_TIMER_WAITFORACKTX: handleWaitForAckTxTimerCallback(); break;
+	case XMAC_TIMER_PHASEWAIT: handlePhaseWaitTimerCallback(); break;
+	case XMAC_TIMER_ANYCASTACK: handleAnycastAckTimerCallback(); break;
 	default: printNonFatalError("Unrecognised timer callback");       break;
 	}
 }
 
 void XMAC::handleCheckPeriodTimerCallback() {
 	printInfo("check period timer fired");
+	if (alwaysOn)
+		return;   // we never stop listening, so there is nothing to check
 	if (currentState == XMAC_STATE_SLEEP) {
+		adaptDutyCycle();
 		wakeUp();
 		doCCA();
 	} else {
 		trace() << "CHECK PERIOD timer called in non-SLEEP state. Resetting it without side effects.";
-		setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+		scheduleCheck();
 	}
 }
 
@@ -125,10 +186,23 @@ void XMAC::handleRetryWakeupTimerCallback() {
 	sendBufferedDataPacket(); // better clarity by doing this, actually
 }
 
+/*
+ *  The DATA that we stayed awake for has not come: the rest of a packet
+ *  train, the DATA for a preamble we acknowledged, or for an anycast
+ *  preamble that the sender gave to another forwarder without our hearing
+ *  it. Whichever it was, we give up on it and go back to our schedule.
+ */
 void XMAC::handleWfDataTimeout() {
-/*	printInfo("Timed out waiting for data after acknowledging preamble.");
-	setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
-	goToSleep();*/
+	if (currentState != XMAC_STATE_WFDATA)
+		return;
+	if (anycastRace.inRace())
+		printInfo("Anycast data never came. Another forwarder must have taken it.");
+	else
+		printInfo("Timed out waiting for data.");
+	anycastRace.leave();
+	moreDataExpected = false;
+	scheduleCheck();
+	goToSleep();
 }
 
 /* largely to keep same structure as bmac */
@@ -172,7 +246,7 @@ void XMAC::handleListenTimeoutCallback() {
 	trace() << "check period timer: " << getTimer(XMAC_TIMER_CHECKPERIOD);
 
 	trace() << "setting check period timer";
-	setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+	scheduleCheck();
 	trace() << "check period timer: " << getTimer(XMAC_TIMER_CHECKPERIOD);
 
 	trace() << "Going to sleep";
@@ -182,10 +256,10 @@ void XMAC::handleListenTimeoutCallback() {
 }
 
 /*
- * Not used.
+ *  Only used before sending to an always-on destination without a preamble.
  */
 bool XMAC::channelIsClear() {
-	return false;
+	return (radioModule->isChannelClear() == CLEAR);
 }
 
 /*
@@ -241,7 +315,7 @@ void XMAC::goToSleep(bool canCheckTxBuffer) {
 	if (canCheckTxBuffer)
 		printInfo("Checking Tx buffer before potentially sleeping.");
 	else {
-		setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+		scheduleCheck();
 		printInfo("Going to sleep immediately.");
 	}
 
@@ -256,12 +330,12 @@ void XMAC::goToSleep(bool canCheckTxBuffer) {
 			sendBufferedDataPacket();
 		} else {
 			printInfo("Sending sleep command to radio layer");
-			toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
-			setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+			toRadioLayer(createRadioCommand(SET_STATE, alwaysOn ? RX : SLEEP));
+			scheduleCheck();
 		}
 	} else {
 		printInfo("Sending sleep command to radio layer");
-		toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+		toRadioLayer(createRadioCommand(SET_STATE, alwaysOn ? RX : SLEEP));
 	}
 }
 
@@ -298,6 +372,25 @@ void XMAC::handleSendDataWaitTimerCallback() {
 	XMacPacket* macPacket = check_and_cast <XMacPacket*>(macBuffer->peek());
 	int destination = macPacket->getDestination();
 
+	/* a destination that is always on doesn't need a preamble */
+	if ((destination != BROADCAST_MAC_ADDRESS) && (numRetries == 1)
+			&& alwaysOnNeighbours.count(destination)) {
+		sendDirect();
+		return;
+	}
+
+	/* a destination whose wakeups we can predict need only be strobed from
+	 * just before its next wakeup */
+	if (!phaseWaitDone) {
+		anycastThisTrain = anycast && (destination != BROADCAST_MAC_ADDRESS);
+		preamblesThisTrain = anycastThisTrain ?
+				getPreamblesFor(BROADCAST_MAC_ADDRESS) : getPreamblesFor(destination);
+		if ((destination != BROADCAST_MAC_ADDRESS) && !anycastThisTrain
+				&& (numRetries == 1) && waitForPhase(destination))
+			return;
+	}
+	phaseWaitDone = false;
+
 	/* increment sequence number & send preamble to required destination */
 	trace() << "About to send preamble sequence!!! Exciting!!!";
 	sendPreamble(destination, ++currentSequenceNumber);
@@ -310,7 +403,7 @@ void XMAC::handlePreambleTimerCallback() {
 	//trace() << "Preamble strobe method called (i.e. number of preambles is currently 2 or greater, and another is about to be sent.";
 	XMacPacket* macPacket = check_and_cast <XMacPacket*>(macBuffer->peek());
 	int destination = macPacket->getDestination();
-	if ((numberOfPreambleRetries++) < numberOfPreambles) {
+	if ((numberOfPreambleRetries++) < preamblesThisTrain) {
 		trace() << "Sending preamble number " << numberOfPreambleRetries;
 		/* send next strobe in the preamble sequence */
 		sendPreamble(destination, currentSequenceNumber);
@@ -325,6 +418,7 @@ void XMAC::handlePreambleTimerCallback() {
 		}
 		/* preamble sequence finished & no reply received: if we have exceeded our maximum number of retries, give up; otherwise, wait some amount of time and try again */
 		printInfo("No response to preamble sequence. Perhaps destination node has died or is intentionally ignoring us.");
+		phaseTable->remove(destination);   // so the retry strobes for longer
 		if (numRetries >= XMAC_NUM_RETRIES) {
 			trace() << "Exceeded maximum number of retries, giving up.";
 			deleteFrontOfBuffer();
@@ -338,6 +432,243 @@ void XMAC::handlePreambleTimerCallback() {
 	}
 }
 
+/*
+ *  Sends the packet at the front of the buffer to an always-on destination,
+ *  without preamble strobes, if the channel is clear. Otherwise the channel
+ *  is checked again after a short random delay.
+ */
+void XMAC::sendDirect() {
+	if (!channelIsClear()) {
+		printInfo("Channel busy: waiting to send to always-on destination");
+		setState(XMAC_STATE_DATASENDWAIT);
+		setTimer(XMAC_TIMER_SENDDATAWAIT,
+				maxDataSendDelay*(rand()/(RAND_MAX + 1.0))/1000);
+		return;
+	}
+	printInfo("Destination is always on: sending without a preamble");
+	collectOutput("Number of preambles skipped", SELF_MAC_ADDRESS);
+	currentSequenceNumber++;
+	sendDataFromFrontOfBuffer();
+	setTimer(XMAC_TIMER_ACKTIMEOUT, maxAckDelay);
+	setState(XMAC_STATE_WFACK);
+}
+
+/*
+ *  Records whether the node that sent us a (preamble) ACK is always on.
+ */
+void XMAC::learnAlwaysOn(XMacPacket* ackPacket) {
+	if (ackPacket->getAlwaysOn())
+		alwaysOnNeighbours.insert(ackPacket->getSource());
+	else
+		alwaysOnNeighbours.erase(ackPacket->getSource());
+}
+
+/*
+ *  @return The time of our next wakeup after now. With phase learning we wake
+ *          up every wakeupInterval, from wakeupOrigin, whatever we have been
+ *          doing in between, so that neighbours can predict our wakeups.
+ */
+simtime_t XMAC::getNextWakeup() {
+	simtime_t now = simTime();
+	if (now < wakeupOrigin)
+		return wakeupOrigin;
+	return wakeupOrigin + wakeupInterval*(floor(SIMTIME_DBL(now - wakeupOrigin)/wakeupInterval) + 1);
+}
+
+/*
+ *  Sets the check period timer for our next wakeup.
+ */
+void XMAC::scheduleCheck() {
+	if (phaseLearning)
+		setTimer(XMAC_TIMER_CHECKPERIOD, getNextWakeup() - simTime());
+	else
+		setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+}
+
+/*
+ *  Tells the destination of a (preamble) ACK when we will next wake up.
+ */
+void XMAC::setPhaseFields(XMacPacket* ackPacket) {
+	if (!phaseLearning)
+		return;
+	ackPacket->setNextWakeup(getNextWakeup() - simTime());
+	ackPacket->setWakeupInterval(wakeupInterval);
+}
+
+/*
+ *  Records the wakeup schedule of the node that sent us a (preamble) ACK. The
+ *  time to its next wakeup was worked out when it started sending the ACK.
+ */
+void XMAC::learnPhase(XMacPacket* ackPacket) {
+	if (!phaseLearning || (ackPacket->getWakeupInterval() <= 0))
+		return;
+	simtime_t sentAt = simTime() - radioTiming->getTxTime(ackPacket->getByteLength());
+	phaseTable->update(ackPacket->getSource(), sentAt + ackPacket->getNextWakeup(),
+			ackPacket->getWakeupInterval(), simTime());
+}
+
+/*
+ *  If the destination's next wakeup can be predicted, shortens the preamble
+ *  sequence to cover the guard time either side of it, and if that is not
+ *  due to start yet, sleeps until it is. Our own wakeups are missed while we
+ *  wait, but that is at most one of them.
+ *
+ *  @return True if we are now waiting for the destination's wakeup, in which
+ *          case the preamble sequence is started by
+ *          handlePhaseWaitTimerCallback().
+ */
+bool XMAC::waitForPhase(int destination) {
+	simtime_t wakeup, guard;
+	if (!phaseLearning || !phaseTable->predict(destination, simTime(), wakeup, guard))
+		return false;
+	simtime_t strobeStart = wakeup - guard;
+	if (strobeStart < simTime())
+		strobeStart = simTime();
+	int preambles = (int)ceil(SIMTIME_DBL(wakeup + guard - strobeStart)/interPreamblePeriod) + 2;
+	if (preambles >= preamblesThisTrain)
+		return false;
+	collectOutput("Number of preambles shortened", SELF_MAC_ADDRESS);
+	preamblesThisTrain = preambles;
+	double wait = SIMTIME_DBL(strobeStart - simTime()) - wakeupDelay;
+	if (wait <= 0)
+		return false;   // strobe straight away
+	trace() << "Destination wakes up in " << (wakeup - simTime()) << " seconds (guard "
+			<< guard << "): sleeping for " << wait << " seconds.";
+	setState(XMAC_STATE_DATASENDWAIT);
+	toRadioLayer(createRadioCommand(SET_STATE, SLEEP));
+	setTimer(XMAC_TIMER_PHASEWAIT, wait);
+	return true;
+}
+
+void XMAC::handlePhaseWaitTimerCallback() {
+	wakeUp();
+	phaseWaitDone = true;
+	setTimer(XMAC_TIMER_SENDDATAWAIT, wakeupDelay);
+}
+
+/*
+ *  Counts a DATA packet for us towards our offered load.
+ */
+void XMAC::noteTraffic() {
+	packetsThisCheck++;
+}
+
+/*
+ *  Called on each wakeup, to fold the DATA packets received since the last
+ *  one into our offered load, and choose the longest check period in which
+ *  we expect at most targetPacketsPerCheck packets. A change of check period
+ *  takes effect after our next wakeup on the old grid, which neighbours may
+ *  already have learnt, and is passed on to them on our next (preamble) ACKs.
+ */
+void XMAC::adaptDutyCycle() {
+	if (!adaptiveDutyCycle)
+		return;
+	double elapsed = SIMTIME_DBL(simTime() - lastLoadUpdate);
+	if (elapsed <= 0)
+		return;
+	offeredLoad = (1-loadAlpha)*offeredLoad + loadAlpha*(packetsThisCheck/elapsed);
+	packetsThisCheck = 0;
+	lastLoadUpdate = simTime();
+
+	int level = 0;
+	while ((level < maxCheckLevel) && (offeredLoad*baseCheckPeriod*(1 << (level+1))
+			<= targetPacketsPerCheck))
+		level++;
+	if (level != checkLevel) {
+		simtime_t nextWakeup = getNextWakeup();
+		checkLevel = level;
+		checkPeriod = baseCheckPeriod*(1 << checkLevel);
+		wakeupInterval = checkPeriod + listenPeriod;
+		wakeupOrigin = nextWakeup;
+		trace() << "Offered load " << offeredLoad << " packets/s: check level now "
+				<< checkLevel << ", check period " << checkPeriod << " seconds.";
+	}
+}
+
+/*
+ *  Records the check level of the node that sent us a (preamble) ACK.
+ */
+void XMAC::learnCheckLevel(XMacPacket* ackPacket) {
+	neighbourCheckLevels[ackPacket->getSource()] = ackPacket->getCheckLevel();
+}
+
+/*
+ *  @return Number of preambles to send to the given destination: enough to
+ *          span its check period, as last advertised in a (preamble) ACK.
+ *          Enough for maxCheckLevel are sent for broadcasts, for neighbours
+ *          we have no ACK from yet, and for retries (in case the destination
+ *          has lengthened its check period since).
+ */
+int XMAC::getPreamblesFor(int destination) {
+	map<int, int>::iterator it = neighbourCheckLevels.find(destination);
+	if ((destination == BROADCAST_MAC_ADDRESS) || (numRetries > 1)
+			|| (it == neighbourCheckLevels.end())) {
+		return numberOfPreambles*(1 << maxCheckLevel);
+	}
+	return numberOfPreambles*(1 << it->second);
+}
+
+/*
+ *  @return True if anycast is enabled and the given preamble (for another
+ *          destination) is an anycast one that we may take: we know our hop
+ *          count to the sink, and it is within the preamble's limit.
+ */
+bool XMAC::isEligibleForwarder(XMacPacket* preamblePacket) {
+	if (!anycast || !preamblePacket->getAnycast() || (hopsToSink < 0)
+			|| (preamblePacket->getDestination() == BROADCAST_MAC_ADDRESS))
+		return false;
+	int maxHopsToSink = preamblePacket->getMaxHopsToSink();
+	return (maxHopsToSink < 0) || (hopsToSink <= maxHopsToSink);
+}
+
+/*
+ *  Called when we can forward a neighbour's anycast preamble. Every eligible
+ *  forwarder that is awake may do the same, so rather than acknowledging at
+ *  once, we wait for a random one of anycastAckSlots slots, listening, and
+ *  give up if another forwarder's ACK or the DATA is heard first.
+ */
+void XMAC::takeAnycastPreamble(int source, int seqNumber) {
+	if (anycastRace.isAckPending() && (anycastRace.getSource() == source))
+		return;   // already waiting for our slot
+	int slot = (int)(anycastAckSlots*(rand()/(RAND_MAX + 1.0)));
+	trace() << "Acknowledging in slot " << slot << " of " << anycastAckSlots;
+	anycastRace.enter(source);
+	anycastAckSeqNumber = seqNumber;
+	setState(XMAC_STATE_WFDATA);
+	setTimer(XMAC_TIMER_ANYCASTACK, slot*anycastAckSlotTime);
+}
+
+/*
+ *  Our slot to acknowledge an anycast preamble has come without our hearing
+ *  another forwarder take it.
+ */
+void XMAC::handleAnycastAckTimerCallback() {
+	if ((currentState != XMAC_STATE_WFDATA) || !anycastRace.isAckPending())
+		return;
+	collectOutput("Number of anycast preambles taken", SELF_MAC_ADDRESS);
+	anycastRace.ackSent();
+	sendPreambleAck(anycastRace.getSource(), anycastAckSeqNumber);
+}
+
+/*
+ *  Called when a neighbour acknowledges our anycast preamble. The packet at
+ *  the front of the buffer is readdressed to it (if it was not the
+ *  destination already), and the routing layer is told that it took the
+ *  packet, and how far it is from the sink.
+ */
+void XMAC::reportForwarderToRouting(XMacPacket* preambleAck) {
+	int forwarder = preambleAck->getSource();
+	trace() << "Anycast preamble taken by " << forwarder << " ("
+			<< preambleAck->getHopsToSink() << " hops to sink)";
+	check_and_cast<XMacPacket*>(macBuffer->peek())->setDestination(forwarder);
+	MacControlMessage* report =
+			new MacControlMessage("XMAC anycast forwarder", MAC_CONTROL_MESSAGE);
+	report->setMacControlMessageKind(MAC_ANYCAST_FORWARDER);
+	report->setNeighbourMacAddress(forwarder);
+	report->setHopsToSink(preambleAck->getHopsToSink());
+	toNetworkLayer(report);
+}
+
 /*
  *  Note: This does /not/ increment the number of preamble retries. This must be done in the calling method.
  *  This method does not handle any state transitions. Again, this must be done by the caller.
@@ -349,6 +680,8 @@ void XMAC::sendPreamble(int destination, int sequenceNumber) {
 	preamblePacket->setDestination(destination);
 	preamblePacket->setType(XMAC_PACKET_PREAMBLE);
 	preamblePacket->setSequenceNumber(currentSequenceNumber);
+	preamblePacket->setAnycast(anycastThisTrain);
+	preamblePacket->setMaxHopsToSink((hopsToSink > 0) ? hopsToSink-1 : -1);
 	printInfo("Sending preamble packet to radio layer");
 	toRadioLayer(preamblePacket);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
@@ -368,6 +701,8 @@ void XMAC::sendDataFromFrontOfBuffer() {
 	dataPacket->setSource(SELF_MAC_ADDRESS);
 	dataPacket->setType(XMAC_PACKET_DATA);
 	dataPacket->setSequenceNumber(currentSequenceNumber);
+	sentMoreData = hasMoreDataFor(dataPacket->getDestination());
+	dataPacket->setMoreData(sentMoreData);
 	trace() << "heree";
 	printInfo("Sending data packet to radio layer");
 	toRadioLayer(dataPacket);
@@ -376,6 +711,32 @@ void XMAC::sendDataFromFrontOfBuffer() {
 }
 
 
+/*
+ *  @return True if packet trains are enabled and the packet after the one at
+ *          the front of the buffer is for the given (unicast) destination.
+ */
+bool XMAC::hasMoreDataFor(int destination) {
+	if (!packetTrains || (destination == BROADCAST_MAC_ADDRESS)
+			|| (macBuffer->numPackets() < 2))
+		return false;
+	XMacPacket* nextPacket = check_and_cast<XMacPacket*>(macBuffer->peek(1));
+	return (nextPacket->getDestination() == destination);
+}
+
+/*
+ *  Sends the packet now at the front of the buffer as part of a packet train:
+ *  the destination has just acknowledged the previous packet, which told it
+ *  to stay awake for this one, so no preamble strobes are needed.
+ */
+void XMAC::sendNextInTrain() {
+	printInfo("Sending next packet of train");
+	numRetries++;
+	currentSequenceNumber++;
+	sendDataFromFrontOfBuffer();
+	setTimer(XMAC_TIMER_ACKTIMEOUT, maxAckDelay);
+	setState(XMAC_STATE_WFACK);
+}
+
 /*
  * Note: does not change state! (This would not make sense, since there are
  * multiple transitions from the sleep state.)
@@ -395,6 +756,16 @@ void XMAC::reset() {
 		cancelTimer(i);
 }
 
+/*
+ *  Called by the simulator at the end of the run.
+ */
+void XMAC::finishSpecific() {
+	delete radioTiming;
+	radioTiming = NULL;
+	delete phaseTable;
+	phaseTable = NULL;
+}
+
 
 void XMAC::setState(int newState) {
 	/* it is always valid to transition to one's own state */
@@ -465,7 +836,12 @@ void XMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 
 	trace() << "Packet received from radio layer! Type: " << macPacket->getType() << ", forUs: " << forUs;
 
-	if (currentState == XMAC_STATE_LISTEN || currentState == XMAC_STATE_WFDATA) {
+	/* an always-on sink is listening even in the SLEEP state, and senders
+	 * may send it data without a preamble */
+	bool alwaysOnIdle = alwaysOn && (currentState == XMAC_STATE_SLEEP);
+
+	if (currentState == XMAC_STATE_LISTEN || currentState == XMAC_STATE_WFDATA
+			|| alwaysOnIdle) {
 		/* attempt to decode a preamble packet */
 		if (macPacket->getType() == XMAC_PACKET_PREAMBLE) {
 			cancelTimer(XMAC_TIMER_LISTENTIMEOUT);
@@ -484,9 +860,14 @@ void XMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 					return;
 				}
 				setState(XMAC_STATE_WFDATA);
+			} else if (isEligibleForwarder(macPacket)) {
+				trace() << "Anycast preamble from " << source << " for "
+						<< destination << ": we can forward it.";
+				takeAnycastPreamble(source, seqNumber);
+				return;
 			} else {  /* overheard */
 				trace() << "Overheard a preamble. Going to sleep.";
-				setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+				scheduleCheck();
 				goToSleep(false);
 				return;
 			}
@@ -497,15 +878,44 @@ void XMAC::fromRadioLayer(cPacket * pkt, double rssi, double lqi) {
 			}
 		}
 	}
-	if (currentState == XMAC_STATE_WFDATA) {
+	if ((currentState == XMAC_STATE_WFDATA) || alwaysOnIdle) {
 		if (forUs && (macPacket->getType() == XMAC_PACKET_DATA)) {
 			collectOutput("Number of DATA packets received", SELF_MAC_ADDRESS);
+			noteTraffic();
 			toNetworkLayer(decapsulatePacket(macPacket));
+			anycastRace.leave();
 			if (destination != BROADCAST_MAC_ADDRESS) {
+				moreDataExpected = macPacket->getMoreData();
 				sendDataAcknowledgement(source, seqNumber);
 			}
 			return;
 		}
+		if ((currentState == XMAC_STATE_WFDATA)
+				&& (macPacket->getType() == XMAC_PACKET_DATA)
+				&& anycastRace.isLostTo(source, destination, SELF_MAC_ADDRESS)) {
+			/* another forwarder acknowledged first, and took the data */
+			printInfo("Anycast data went to another forwarder. Going to sleep.");
+			if (anycastRace.isAckPending())
+				collectOutput("Number of anycast preambles lost before acking", SELF_MAC_ADDRESS);
+			anycastRace.leave();
+			cancelTimer(XMAC_TIMER_ANYCASTACK);
+			cancelTimer(XMAC_TIMER_WFDATATIMEOUT);
+			scheduleCheck();
+			goToSleep(false);
+			return;
+		}
+		if ((currentState == XMAC_STATE_WFDATA)
+				&& (macPacket->getType() == XMAC_PACKET_PREAMBLE_ACK)
+				&& anycastRace.isBeatenBy(source, destination, SELF_MAC_ADDRESS)) {
+			/* another forwarder's slot came first: don't collide with it */
+			printInfo("Another forwarder took the anycast preamble. Going to sleep.");
+			collectOutput("Number of anycast preambles lost before acking", SELF_MAC_ADDRESS);
+			anycastRace.leave();
+			cancelTimer(XMAC_TIMER_ANYCASTACK);
+			scheduleCheck();
+			goToSleep(false);
+			return;
+		}
 	}
 	if (currentState == XMAC_STATE_PREAMBLE_SEND) {
 		trace() << "Received a packet in the XMAC_STATE_PREAMBLE_SEND state";
@@ -518,6 +928,11 @@ trace() << "The preamble ack was intended for us";
 
 			// could check sequence numbers match here, but not a lot of point
 			collectOutput("Number of preamble acks received", SELF_MAC_ADDRESS);
+			learnAlwaysOn(macPacket);
+			learnPhase(macPacket);
+			learnCheckLevel(macPacket);
+			if (anycastThisTrain)
+				reportForwarderToRouting(macPacket);
 			numberOfPreambleRetries = 0;   // yes, this is intentionally duplicated below, for now
 			sendDataFromFrontOfBuffer();
 
@@ -533,7 +948,7 @@ trace() << "The preamble ack was intended for us";
 			//printInfo("Overheard preamble acknowledgement");
 			trace() << "Overheard preamble acknowledgement. destination: " << destination;
 			numberOfPreambleRetries = 0;    // perhaps also reset numRetries, see how it goes :)
-			setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+			scheduleCheck();
 			goToSleep(false);
 			return;
 		}
@@ -542,9 +957,16 @@ trace() << "The preamble ack was intended for us";
 		if (forUs && (macPacket->getType() == XMAC_PACKET_ACK)) {
 			trace() << "GOT ACK!!! deleting sent packet from buffer.";
 			collectOutput("Number of acks received", SELF_MAC_ADDRESS);
+			learnAlwaysOn(macPacket);
+			learnPhase(macPacket);
+			learnCheckLevel(macPacket);
 			cancelTimer(XMAC_TIMER_ACKTIMEOUT);
 			deleteFrontOfBuffer();
-			goToSleep(true);
+			if (sentMoreData && (macBuffer->numPackets() > 0)) {
+				sendNextInTrain();
+			} else {
+				goToSleep(true);
+			}
 			return;
 		}
 	}
@@ -566,6 +988,10 @@ void XMAC::sendPreambleAck(int source, int seqNumber) {
 	preambleAck->setSource(SELF_MAC_ADDRESS);
 	preambleAck->setDestination(destination);
 	preambleAck->setSequenceNumber(seqNumber);
+	preambleAck->setAlwaysOn(alwaysOn);
+	setPhaseFields(preambleAck);
+	preambleAck->setCheckLevel(checkLevel);
+	preambleAck->setHopsToSink(hopsToSink);
 	toRadioLayer(preambleAck);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
 }
@@ -582,6 +1008,9 @@ void XMAC::sendDataAcknowledgement(int source, int seqNumber) {
 	ack->setType(XMAC_PACKET_ACK);
 	ack->setSource(SELF_MAC_ADDRESS);
 	ack->setDestination(destination);
+	ack->setAlwaysOn(alwaysOn);
+	setPhaseFields(ack);
+	ack->setCheckLevel(checkLevel);
 	trace() << "Sending acknowledgement to radio layer";
 	toRadioLayer(ack);
 	toRadioLayer(createRadioCommand(SET_STATE, TX));
@@ -589,8 +1018,14 @@ void XMAC::sendDataAcknowledgement(int source, int seqNumber) {
 }
 
 void XMAC::handleWaitForAckTxTimerCallback() {
+	if (moreDataExpected) {
+		/* stay in the WFDATA state for the next packet of the train */
+		printInfo("Sender has more data for us: staying awake");
+		setTimer(XMAC_TIMER_WFDATATIMEOUT, maxDataDelay);
+		return;
+	}
 	trace() << "Given radio layer enough time to send ack. Going to sleep.";
-	setTimer(XMAC_TIMER_CHECKPERIOD, XMAC_CHECK_PERIOD);
+	scheduleCheck();
 	goToSleep();
 }
 
@@ -599,6 +1034,26 @@ int XMAC::handleRadioControlMessage(cMessage*) {
 	return 0;
 }
 
+/*
+ *  Handles control commands from the routing layer. The only one we act on
+ *  tells us our hop count to the sink, for anycast; other routing commands
+ *  are meant for other MAC protocols and are ignored.
+ *
+ *  @return 1 if the command was handled; 0 otherwise.
+ */
+int XMAC::handleControlCommand(cMessage* msg) {
+	MacControlMessage* command = dynamic_cast <MacControlMessage*>(msg);
+	if (command == NULL) {
+		printNonFatalError("Unrecognised control command. Ignoring.");
+		return 0;
+	}
+	if (command->getMacControlMessageKind() != MAC_SET_HOPS_TO_SINK)
+		return 1;
+	hopsToSink = command->getHopsToSink();
+	trace() << "Now " << hopsToSink << " hops from the sink";
+	return 1;
+}
+
 void XMAC::deleteFrontOfBuffer() {
 	trace() << "Deleting buffered packet";
 	cancelAndDelete(macBuffer->peek());
@@ -10,19 +10,21 @@
 
 #include "VirtualMac.h"
 #include "XMacPacket_m.h"
+#include "../macControl/MacControlMessage_m.h"
 #include "../macBuffer/MacBuffer.h"
+#include "../radioTiming/RadioTiming.h"
+#include "PhaseTable.h"
+#include "AnycastRace.h"
 #include <assert.h>
 #include <string>
+#include <set>
+#include <map>
 #include "../../CastaliaIncludes.h"
 
 using namespace std;
 
 // TODO tidy up all the defines into a column layout
 
-// TODO change this to an inline function
-//#ifndef TX_TIME(x)
-#define TX_TIME(x)		(phyLayerOverhead + x)*1/(1000*phyDataRate/8.0)	//x are in BYTES
-
 /**** defining these two macros was silly (should be in ned file). these parameters are
  * now in fact in the ned file, so delete these macros as soon as possible.          */
 // time we ordinarily listen for
@@ -38,7 +40,7 @@ using namespace std;
 #define PROTOCOL_NAME "XMAC"
 
 #define XMAC_NUMBER_OF_STATES 7
-#define XMAC_NUMBER_OF_TIMERS 10
+#define XMAC_NUMBER_OF_TIMERS 12
 
 /*
  *  TODO: description
@@ -70,7 +72,9 @@ enum XmacTimers {
 	XMAC_TIMER_PREAMBLESTROBE,
 	XMAC_TIMER_RETRY,
 	XMAC_TIMER_RETRYWAKEUP,
-	XMAC_TIMER_WAITFORACKTX
+	XMAC_TIMER_WAITFORACKTX,
+	XMAC_TIMER_PHASEWAIT,
+	XMAC_TIMER_ANYCASTACK
 };
 
 class XMAC : public VirtualMac {
@@ -80,6 +84,7 @@ private:
 	double phyDelayForValidCS;
 	double phyDataRate;
 	int phyFrameOverhead;
+	RadioTiming* radioTiming;   // airtimes, from the above and wakeupDelay
 	double listenPeriod;
 	double checkPeriod;
 	double interAckPeriod;
@@ -116,6 +121,8 @@ private:
 	void handleRetryTimerCallback();
 	void handleRetryWakeupTimerCallback();
 	void handleWaitForAckTxTimerCallback();
+	void handlePhaseWaitTimerCallback();
+	void handleAnycastAckTimerCallback();
 	/* end timer callback functions */
 
 	/* begin cca functions */
@@ -130,6 +137,11 @@ private:
 	void sendDataFromFrontOfBuffer();
 	void resendData();
 	int numRetries;
+	bool packetTrains;           // from .ned file
+	bool sentMoreData;           // set on the DATA packet we last sent
+	bool moreDataExpected;       // set on the DATA packet we last received
+	bool hasMoreDataFor(int destination);
+	void sendNextInTrain();
 	/* end sending data functions and state */
 
 	/* begin preamble manipulation functions */
@@ -137,6 +149,57 @@ private:
 	void sendPreamble(int destination, int sequenceNumber);
 	/* end preamble manipulation functions */
 
+	/* begin always-on sink state */
+	bool alwaysOn;                 // we are a sink in sinkAlwaysOn mode
+	set<int> alwaysOnNeighbours;   // learnt from their (preamble) ACKs
+	void learnAlwaysOn(XMacPacket* ackPacket);
+	void sendDirect();
+	/* end always-on sink state */
+
+	/* begin phase learning state and functions */
+	bool phaseLearning;            // from .ned file
+	PhaseTable* phaseTable;        // neighbours' wakeup schedules
+	simtime_t wakeupOrigin;        // our first wakeup; the rest follow on
+	double wakeupInterval;         // between our wakeups
+	int preamblesThisTrain;        // fewer than numberOfPreambles if predicted
+	bool phaseWaitDone;            // woken up for a predicted wakeup
+	simtime_t getNextWakeup();
+	void scheduleCheck();
+	void setPhaseFields(XMacPacket* ackPacket);
+	void learnPhase(XMacPacket* ackPacket);
+	bool waitForPhase(int destination);
+	/* end phase learning state and functions */
+
+	/* begin adaptive duty cycle state and functions */
+	bool adaptiveDutyCycle;        // from .ned file
+	int maxCheckLevel;             // from .ned file
+	double loadAlpha;              // from .ned file
+	double targetPacketsPerCheck;  // from .ned file
+	double baseCheckPeriod;        // checkPeriod at check level 0
+	int checkLevel;                // we sleep 2^checkLevel times the base
+	double offeredLoad;            // DATA packets for us per second
+	int packetsThisCheck;
+	simtime_t lastLoadUpdate;
+	map<int, int> neighbourCheckLevels;   // learnt from their (preamble) ACKs
+	void noteTraffic();
+	void adaptDutyCycle();
+	void learnCheckLevel(XMacPacket* ackPacket);
+	int getPreamblesFor(int destination);
+	/* end adaptive duty cycle state and functions */
+
+	/* begin anycast state and functions */
+	bool anycast;                  // from .ned file
+	bool anycastThisTrain;         // set on the preambles being sent
+	int hopsToSink;                // from the routing layer, -1 if unknown
+	AnycastRace anycastRace;       // for the anycast preamble we last took
+	double anycastAckSlotTime;     // long enough to hear an earlier ACK
+	int anycastAckSlots;           // that fit between two strobes
+	int anycastAckSeqNumber;       // of the preamble we are yet to ACK
+	bool isEligibleForwarder(XMacPacket* preamblePacket);
+	void takeAnycastPreamble(int source, int seqNumber);
+	void reportForwarderToRouting(XMacPacket* preambleAck);
+	/* end anycast state and functions */
+
 	/* begin debug functions */
 	void printNonFatalError(string);
 	void printFatalError(string);
@@ -172,14 +235,16 @@ private:
 protected:
 	void startup();
 	void reset();
+	void finishSpecific();
 	void timerFiredCallback(int);
 	void fromNetworkLayer(cPacket *, int);
 	void fromRadioLayer(cPacket *, double, double);
 	int handleRadioControlMessage(cMessage *);
+	int handleControlCommand(cMessage *);
 };
 
 const string XMAC::XmacStateNames [XMAC_NUMBER_OF_STATES] = { "XMAC_STATE_SLEEP", "XMAC_STATE_CCA", "XMAC_STATE_LISTEN", "XMAC_STATE_WFDATA", "XMAC_STATE_WFACK", "XMAC_STATE_PREAMBLESEND", "XMAC_STATE_DATASENDWAIT" };
-const string XMAC::XmacTimerNames [XMAC_NUMBER_OF_TIMERS] = { "XMAC_TIMER_CHECKPERIOD",	"XMAC_TIMER_ACKTIMEOUT", "XMAC_TIMER_LISTENTIMEOUT", "XMAC_TIMER_WFRADIO_CCA", "XMAC_TIMER_WFDATATIMEOUT", "XMAC_TIMER_SENDDATAWAIT", "XMAC_TIMER_PREAMBLESTROBE", "XMAC_TIMER_RETRY", "XMAC_TIMER_RETRYWAKEUP", "XMAC_TIMER_WAITFORACKTX" };
+const string XMAC::XmacTimerNames [XMAC_NUMBER_OF_TIMERS] = { "XMAC_TIMER_CHECKPERIOD",	"XMAC_TIMER_ACKTIMEOUT", "XMAC_TIMER_LISTENTIMEOUT", "XMAC_TIMER_WFRADIO_CCA", "XMAC_TIMER_WFDATATIMEOUT", "XMAC_TIMER_SENDDATAWAIT", "XMAC_TIMER_PREAMBLESTROBE", "XMAC_TIMER_RETRY", "XMAC_TIMER_RETRYWAKEUP", "XMAC_TIMER_WAITFORACKTX", "XMAC_TIMER_PHASEWAIT", "XMAC_TIMER_ANYCASTACK" };
 
 
 #endif /* def XMAC_H_ */
@@ -41,6 +41,10 @@ void FloodingRouting::startup() {
   	}
 
   	printDebugInfo = par("printDebugInfo");
+  	piggybackOnSync = par("piggybackOnSync");
+  	syncPayload = SETUP_PACKET;
+  	hopsToSink = isSink ? 0 : -1;
+  	syncNeighboursHeard = false;
 
 	/* after some random time, make sure our neighbours know about us */
 	int seed = *SELF_NETWORK_ADDRESS;    // seed with a number unique to us, otherwise all nodes will have the same startup delay (converts const char* to int)
@@ -84,7 +88,7 @@ void FloodingRouting::startup() {
  */
 void FloodingRouting::timerFiredCallback(int timer) {
 	switch(timer) {
-	case FR_TIMER_SINKDISCOVERY:
+	case FR_TIMER_SINKDISCOVERY: handleSinkDiscoveryTimerCallback(); break;
 	case FR_TIMER_STARTUP:   handleStartupTimerCallback(); break;
 	case FR_TIMER_MAXSTARTUP:   startupComplete=true; break;
 	default: trace() << "ERROR: Unrecognised timer callback.";
@@ -108,6 +112,8 @@ void FloodingRouting::handleStartupTimerCallback() {
   	setupPacket->setSource(SELF_NETWORK_ADDRESS);
   	setupPacket->setDestination(BROADCAST_NETWORK_ADDRESS);
   	toMacLayer(setupPacket, BROADCAST_MAC_ADDRESS);
+  	registerSyncPayload();
+  	registerHopsToSink();
 
   	if (!isSink) {
   		trace() << "Initialisation complete.";
@@ -118,6 +124,38 @@ void FloodingRouting::handleStartupTimerCallback() {
 }
 
 
+/**
+ *  Handler method for FR_TIMER_SINKDISCOVERY.
+ *  Rebroadcasts the setup packet, unless the MAC layer is already carrying
+ *  our setup information on its SYNCs (in which case our neighbours hear
+ *  from us without it).
+ */
+void FloodingRouting::handleSinkDiscoveryTimerCallback() {
+	if (piggybackOnSync && syncNeighboursHeard) {
+		if (printDebugInfo)
+			trace() << "Setup information piggybacked on SYNCs. "
+			        << "Not rebroadcasting setup packet.";
+		if (isSink)
+			setTimer(FR_TIMER_SINKDISCOVERY, 30);
+		return;
+	}
+	handleStartupTimerCallback();
+}
+
+/**
+ *  A neighbour heard through the MAC layer is treated as if we had received
+ *  its setup packet (there is no need to reply, as the neighbour hears our
+ *  SYNCs too, or has just taken a packet from us).
+ */
+void FloodingRouting::neighbourHeard(int macAddress, int neighbourHopsToSink,
+		bool onSync) {
+	neighbourList->add(new Neighbour(macAddress, this));
+	if (onSync)
+		syncNeighboursHeard = true;
+	learnHopsToSink(neighbourHopsToSink);
+}
+
+
 void FloodingRouting::fromMacLayer(cPacket* pkt, int srcMacAddress,
 		double RSSI, double LQI) {
   // srcMacAddress is the last hop mac address
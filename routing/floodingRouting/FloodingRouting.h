@@ -13,7 +13,7 @@
 
 #include <map>
 #include <string>
-#include "VirtualRouting.h"
+#include "../sandridgeRouting/SandridgeRouting.h"
 #include "../neighbours/Neighbour.h"
 #include "FloodingNeighbourList.h"
 #include "FloodingRoutingPacket_m.h"
@@ -28,15 +28,20 @@ enum FloodingRoutingTimers {
   FR_TIMER_SINKDISCOVERY
 };
 
-class FloodingRouting: public VirtualRouting {
+class FloodingRouting: public SandridgeRouting {
  private:
 	int mySeqNumber;       // sequence number for data packets originating here
 	FloodingNeighbourList* neighbourList;
-	bool isSink, printDebugInfo, startupComplete;
+	bool startupComplete;
 	int minStartupDelay, maxStartupDelay;
 
+	/* with piggybackOnSync, the periodic setup broadcast is not needed once
+	 * we have heard a neighbour's SYNC */
+	bool syncNeighboursHeard;
+
 	/**** timer callbacks ****/
 	void handleStartupTimerCallback();
+	void handleSinkDiscoveryTimerCallback();
 	/**** end timer callbacks ****/
 
  protected:
@@ -45,6 +50,7 @@ class FloodingRouting: public VirtualRouting {
 	void fromApplicationLayer(cPacket *, const char *);
 	void fromMacLayer(cPacket *, int, double, double);
 	void handleFloodingRoutingControlMessage(cMessage* msg);
+	void neighbourHeard(int macAddress, int neighbourHopsToSink, bool onSync);
 	void timerFiredCallback(int);
 };
 
@@ -57,6 +57,8 @@ void NeighbourList::add(Neighbour* newNeighbour) {
 
 /*
  *  Should be called whenever we receive a packet from station at the MAC layer.
+ *  The list takes ownership of newNeighbour: if the station is already listed,
+ *  its timestamp is refreshed and newNeighbour is deleted.
  */
 void NeighbourList::add(Neighbour* newNeighbour, simtime_t simtime) {
   castaliaModule->trace() << "NeighbourList: Received new neighbour. Simtime: " << simtime << ".";
@@ -65,6 +67,7 @@ void NeighbourList::add(Neighbour* newNeighbour, simtime_t simtime) {
 	if (newMacAddress == ourMacAddress) {  // purely for robustness: make sure
 		castaliaModule->trace() <<         // we can't add ourself
 				"ERROR: tried to add self to NL.";
+		delete newNeighbour;
 		return;
 	}
 	list<Neighbour*>::const_iterator it;
@@ -72,8 +75,9 @@ void NeighbourList::add(Neighbour* newNeighbour, simtime_t simtime) {
 		castaliaModule->trace() << "Testing to see if it's equal to neighbour " << (*it)->getMacAddress();
 		//if ((*it) == newNeighbour) {  // TODO fix operator overloading
 		if ((*it)->getMacAddress() == newNeighbour->getMacAddress()) {
-			castaliaModule->trace() << "It's already in the list. Returning with no side effects.";
+			castaliaModule->trace() << "It's already in the list. Updating its timestamp.";
 			(*it)->updateTimestamp(simtime);
+			delete newNeighbour;
 			return;
 		}
 		castaliaModule->trace() << "Wasn't equal";
@@ -34,7 +34,7 @@ public:
 	NeighbourList(CastaliaModule* castaliaModule, int neighbourTimeout, int ourMacAddress);
 	virtual ~NeighbourList();
 	void add(Neighbour* newNeighbour);   // TODO legacy, delete asap
-	void add(Neighbour* newNeighbour, simtime_t simtime);   // adds neighbour if not already in list, otherwise updates timestamp
+	void add(Neighbour* newNeighbour, simtime_t simtime);   // adds neighbour if not already in list, otherwise updates timestamp and deletes newNeighbour
 	void clean(simtime_t simtime);   // cleans neighbours whose timestamps are older than certain amount
 	void clean();  // TODO delete this
 	virtual list<Neighbour*> pickNeighbours() = 0;
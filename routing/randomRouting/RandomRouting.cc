@@ -31,6 +31,9 @@ void RandomRouting::startup() {
   	}
 
   	printDebugInfo = par("printDebugInfo");
+  	piggybackOnSync = par("piggybackOnSync");
+  	syncPayload = SETUP_PACKET;
+  	hopsToSink = isSink ? 0 : -1;
 
 	/* after some random time, make sure our neighbours know about us */
   	// seed with a number unique to us, otherwise all nodes will have the
@@ -109,6 +112,8 @@ void RandomRouting::handleStartupTimerCallback() {
   	setupPacket->setSource(SELF_NETWORK_ADDRESS);
   	setupPacket->setDestination(BROADCAST_NETWORK_ADDRESS);
   	toMacLayer(setupPacket, BROADCAST_MAC_ADDRESS);
+  	registerSyncPayload();
+  	registerHopsToSink();
 
   	setTimer(RR_TIMER_REDISCOVER, rediscoverTime);
 
@@ -171,6 +176,19 @@ void RandomRouting::rediscoverNeighbours() {
 	setTimer(RR_TIMER_REDISCOVER, rediscoverTime);
 }
 
+/**
+ *  A neighbour heard through the MAC layer is refreshed in the neighbour
+ *  list, just as its setup packet would, so neighbours whose SYNCs we hear
+ *  never become old and need no rediscovery.
+ */
+void RandomRouting::neighbourHeard(int macAddress, int neighbourHopsToSink,
+		bool) {
+	if (!isAlive)
+		return;
+	neighbourList->add(new Neighbour(macAddress, this, getClock()), getClock());
+	learnHopsToSink(neighbourHopsToSink);
+}
+
 /**
  *  Called by the simulator at the end of the simulation.
  *  Deletes neighbour list and prints a message to show we've finished.
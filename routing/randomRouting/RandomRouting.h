@@ -12,7 +12,7 @@
 
 #include <map>
 #include <string>
-#include "VirtualRouting.h"
+#include "../sandridgeRouting/SandridgeRouting.h"
 #include "../neighbours/Neighbour.h"
 #include "RandomNeighbourList.h"
 #include "RandomRoutingPacket_m.h"
@@ -29,11 +29,11 @@ enum RandomRoutingTimers {
   RR_TIMER_END
 };
 
-class RandomRouting: public VirtualRouting {
+class RandomRouting: public SandridgeRouting {
  private:
 	int mySeqNumber;       // sequence number for data packets originating here
 	RandomNeighbourList* neighbourList;
-	bool isSink, printDebugInfo, startupComplete, hasEnded, isAlive;
+	bool startupComplete, hasEnded, isAlive;
 	bool dieTimeHasPassed, nodeShouldDie;
 	int minStartupDelay, maxStartupDelay, neighbourOldAge, rediscoverTime;
 	int strength;
@@ -55,6 +55,7 @@ class RandomRouting: public VirtualRouting {
 	void fromApplicationLayer(cPacket *, const char *);
 	void fromMacLayer(cPacket *, int, double, double);
 	void handleRandomRoutingControlMessage(cMessage* msg);
+	void neighbourHeard(int macAddress, int neighbourHopsToSink, bool onSync);
 	void timerFiredCallback(int);
 };
 
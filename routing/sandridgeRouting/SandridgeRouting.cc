@@ -0,0 +1,99 @@
+/*
+ *  SandridgeRouting.cc
+ *  Matthew Ireland, University of Cambridge
+ *
+ *  Base class for the routing protocols in this project. It holds what they
+ *  share in talking to the MAC layer: registering our setup information to
+ *  be piggybacked on the MAC's SYNCs, keeping track of (and telling the MAC)
+ *  our hop count to the sink, and making sense of the neighbour reports
+ *  that the MAC passes up (see MacControlMessage.msg).
+ */
+
+#include "SandridgeRouting.h"
+
+/**
+ *  Asks the MAC layer to carry our setup information on its SYNCs. MAC
+ *  protocols without SYNCs ignore the request.
+ */
+void SandridgeRouting::registerSyncPayload() {
+	if (!piggybackOnSync)
+		return;
+	MacControlMessage* command =
+			new MacControlMessage("routing SYNC payload", MAC_CONTROL_COMMAND);
+	command->setMacControlMessageKind(MAC_SET_ROUTING_PAYLOAD);
+	command->setHasRoutingPayload(true);
+	command->setRoutingPayload(syncPayload);
+	command->setHopsToSink(hopsToSink);
+	toMacLayer(command);
+}
+
+/**
+ *  Our hop count to the sink is one more than that of the closest neighbour
+ *  we have heard from. When it changes, the MAC layer is told (it may
+ *  stagger its wakeups by it), and so are our neighbours, through our SYNCs.
+ *
+ *  @param neighbourHopsToSink A neighbour's hop count to the sink, as
+ *                             reported by the MAC, or -1 if it doesn't know.
+ */
+void SandridgeRouting::learnHopsToSink(int neighbourHopsToSink) {
+	if (isSink || (neighbourHopsToSink < 0))
+		return;
+	if ((hopsToSink < 0) || (neighbourHopsToSink+1 < hopsToSink)) {
+		hopsToSink = neighbourHopsToSink+1;
+		if (printDebugInfo)
+			trace() << "Now " << hopsToSink << " hops from the sink";
+		registerSyncPayload();
+		registerHopsToSink();
+	}
+}
+
+/**
+ *  Tells the MAC layer our hop count to the sink, which X-MAC uses to decide
+ *  which neighbours may forward our packets (and whose it may forward) when
+ *  it anycasts. Other MAC protocols ignore it.
+ */
+void SandridgeRouting::registerHopsToSink() {
+	MacControlMessage* command =
+			new MacControlMessage("routing hops to sink", MAC_CONTROL_COMMAND);
+	command->setMacControlMessageKind(MAC_SET_HOPS_TO_SINK);
+	command->setHopsToSink(hopsToSink);
+	toMacLayer(command);
+}
+
+/**
+ *  Called when the MAC layer passes up a control message. A SYNC carrying a
+ *  neighbour's setup information, and a neighbour that took one of our
+ *  packets by acknowledging an anycast preamble, are both passed to
+ *  neighbourHeard(). The hop count on any SYNC is learnt, whether or not we
+ *  piggyback on SYNCs ourselves. Other messages are handled as normal.
+ */
+void SandridgeRouting::handleMacControlMessage(cMessage* msg) {
+	MacControlMessage* report = dynamic_cast <MacControlMessage*>(msg);
+	if ((report != NULL) && (report->getMacControlMessageKind()
+			== MAC_ANYCAST_FORWARDER)) {
+		if (printDebugInfo)
+			trace() << "Packet taken by anycast forwarder "
+			        << report->getNeighbourMacAddress();
+		neighbourHeard(report->getNeighbourMacAddress(),
+				report->getHopsToSink(), false);
+		delete msg;
+		return;
+	}
+	if ((report == NULL)
+			|| (report->getMacControlMessageKind() != MAC_NEIGHBOUR_HEARD)) {
+		VirtualRouting::handleMacControlMessage(msg);
+		return;
+	}
+	if (!piggybackOnSync) {
+		learnHopsToSink(report->getHopsToSink());
+	} else if (report->getHasRoutingPayload()
+			&& (report->getRoutingPayload() == syncPayload)) {
+		if (printDebugInfo)
+			trace() << "Setup information from "
+			        << report->getNeighbourMacAddress()
+			        << " piggybacked on SYNC";
+		neighbourHeard(report->getNeighbourMacAddress(),
+				report->getHopsToSink(), true);
+	}
+	delete msg;
+}
@@ -0,0 +1,44 @@
+/*
+ *  SandridgeRouting.h
+ *  Matthew Ireland, University of Cambridge
+ *
+ *  Base class for the routing protocols in this project. It holds what they
+ *  share in talking to the MAC layer: registering our setup information to
+ *  be piggybacked on the MAC's SYNCs, keeping track of (and telling the MAC)
+ *  our hop count to the sink, and making sense of the neighbour reports
+ *  that the MAC passes up (see MacControlMessage.msg).
+ */
+
+#ifndef _SANDRIDGEROUTING_H_
+#define _SANDRIDGEROUTING_H_
+
+#include "VirtualRouting.h"
+#include "MacControlMessage_m.h"
+
+using namespace std;
+
+class SandridgeRouting: public VirtualRouting {
+ protected:
+	bool isSink, printDebugInfo;
+
+	/* with piggybackOnSync, our setup information (syncPayload) rides on the
+	 * MAC's SYNCs, if it has them */
+	bool piggybackOnSync;
+	int syncPayload;
+	void registerSyncPayload();
+	int hopsToSink;   // learnt from neighbours, -1 if unknown
+	void learnHopsToSink(int neighbourHopsToSink);
+	void registerHopsToSink();
+
+	/**
+	 *  Called when the MAC layer reports that we have heard from a
+	 *  neighbour: its SYNC carried our setup information (onSync), or it
+	 *  took one of our packets as an anycast forwarder.
+	 */
+	virtual void neighbourHeard(int macAddress, int neighbourHopsToSink,
+			bool onSync) = 0;
+
+	void handleMacControlMessage(cMessage* msg);
+};
+
+#endif              // _SANDRIDGEROUTING_H_
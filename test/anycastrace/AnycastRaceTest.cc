@@ -0,0 +1,98 @@
+/*
+ * AnycastRaceTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "AnycastRaceTest.h"
+#include "AnycastRace.h"
+
+AnycastRaceTest::AnycastRaceTest() {
+	TEST_ADD(AnycastRaceTest::test_enter_leave)
+	TEST_ADD(AnycastRaceTest::test_lost_to_winner)
+	TEST_ADD(AnycastRaceTest::test_lost_by_timeout)
+	TEST_ADD(AnycastRaceTest::test_not_racing)
+	TEST_ADD(AnycastRaceTest::test_beaten_while_ack_pending)
+	TEST_ADD(AnycastRaceTest::test_ack_sent_first)
+}
+
+void AnycastRaceTest::test_enter_leave() {
+	AnycastRace* ar = new AnycastRace();
+	TEST_ASSERT(!ar->inRace());
+	ar->enter(3);
+	TEST_ASSERT(ar->inRace());
+	TEST_ASSERT(ar->getSource() == 3);
+	ar->enter(4);   // replaces the earlier race
+	TEST_ASSERT(ar->getSource() == 4);
+	ar->leave();
+	TEST_ASSERT(!ar->inRace());
+	delete ar;
+}
+
+void AnycastRaceTest::test_lost_to_winner() {
+	// we (1) took 3's anycast preamble, but 3 sent the DATA to 2
+	AnycastRace* ar = new AnycastRace();
+	ar->enter(3);
+	TEST_ASSERT(ar->isLostTo(3, 2, 1));
+	TEST_ASSERT(!ar->isLostTo(3, 1, 1));   // the DATA came to us: we won
+	TEST_ASSERT(!ar->isLostTo(5, 2, 1));   // someone else's DATA
+	delete ar;
+}
+
+void AnycastRaceTest::test_lost_by_timeout() {
+	// we never hear the winner's DATA, and give up waiting: later DATA from
+	// the same sender is no longer taken as the end of the race
+	AnycastRace* ar = new AnycastRace();
+	ar->enter(3);
+	ar->leave();
+	TEST_ASSERT(!ar->inRace());
+	TEST_ASSERT(!ar->isLostTo(3, 2, 1));
+	delete ar;
+}
+
+void AnycastRaceTest::test_not_racing() {
+	AnycastRace* ar = new AnycastRace();
+	TEST_ASSERT(!ar->isLostTo(3, 2, 1));
+	TEST_ASSERT(!ar->isLostTo(ANYCAST_NO_RACE, 2, 1));
+	delete ar;
+}
+
+void AnycastRaceTest::test_beaten_while_ack_pending() {
+	// we (1) are waiting for our slot to acknowledge 3's preamble, and
+	// overhear 2 acknowledge it first
+	AnycastRace* ar = new AnycastRace();
+	ar->enter(3);
+	TEST_ASSERT(ar->isAckPending());
+	TEST_ASSERT(ar->isBeatenBy(2, 3, 1));
+	TEST_ASSERT(!ar->isBeatenBy(1, 3, 1));   // our own ACK
+	TEST_ASSERT(!ar->isBeatenBy(2, 5, 1));   // an ACK for someone else
+	TEST_ASSERT(ar->isLostTo(3, 2, 1));      // or the DATA going to 2
+	delete ar;
+}
+
+void AnycastRaceTest::test_ack_sent_first() {
+	// once our ACK is sent, another forwarder's ACK doesn't say who won:
+	// only the DATA (or its absence) does
+	AnycastRace* ar = new AnycastRace();
+	ar->enter(3);
+	ar->ackSent();
+	TEST_ASSERT(ar->inRace());
+	TEST_ASSERT(!ar->isAckPending());
+	TEST_ASSERT(!ar->isBeatenBy(2, 3, 1));
+	TEST_ASSERT(ar->isLostTo(3, 2, 1));
+	ar->enter(3);   // the sender didn't hear us, and strobes again
+	TEST_ASSERT(ar->isAckPending());
+	ar->leave();
+	TEST_ASSERT(!ar->isAckPending());
+	TEST_ASSERT(!ar->isBeatenBy(2, 3, 1));
+	delete ar;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new AnycastRaceTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
@@ -0,0 +1,31 @@
+/*
+ * AnycastRaceTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef ANYCASTRACETEST_H_
+#define ANYCASTRACETEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class AnycastRaceTest : public Test::Suite {
+public:
+	AnycastRaceTest();
+
+private:
+	void test_enter_leave();
+	void test_lost_to_winner();
+	void test_lost_by_timeout();
+	void test_not_racing();
+	void test_beaten_while_ack_pending();
+	void test_ack_sent_first();
+
+};
+
+#endif /* ANYCASTRACETEST_H_ */
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the anycast race
+# USAGE: ./testanycastrace.sh
+
+# copy anycast race files and compile
+make
+
+# run test
+./anycastracetest
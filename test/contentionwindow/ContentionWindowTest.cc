@@ -0,0 +1,80 @@
+/*
+ * ContentionWindowTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "ContentionWindowTest.h"
+#include "ContentionWindow.h"
+#include <cmath>
+
+ContentionWindowTest::ContentionWindowTest() {
+	TEST_ADD(ContentionWindowTest::test_uniform)
+	TEST_ADD(ContentionWindowTest::test_sift_range)
+	TEST_ADD(ContentionWindowTest::test_sift_increasing)
+	TEST_ADD(ContentionWindowTest::test_slot_start)
+}
+
+void ContentionWindowTest::test_uniform() {
+	ContentionWindow* cw = new ContentionWindow(8, 0.001, false, 512);
+	TEST_ASSERT(cw->chooseSlot(0.0) == 0);
+	TEST_ASSERT(cw->chooseSlot(0.124) == 0);
+	TEST_ASSERT(cw->chooseSlot(0.126) == 1);
+	TEST_ASSERT(cw->chooseSlot(0.999) == 7);
+	TEST_ASSERT(cw->chooseSlot(1.0) == 7);   // clamped
+	delete cw;
+}
+
+void ContentionWindowTest::test_sift_range() {
+	ContentionWindow* cw = new ContentionWindow(32, 0.001, true, 512);
+	TEST_ASSERT(cw->chooseSlot(0.0) == 0);
+	TEST_ASSERT(cw->chooseSlot(1.0) == 31);
+	for (int i = 0; i < 1000; i++) {
+		int slot = cw->chooseSlot(i/1000.0);
+		TEST_ASSERT((slot >= 0) && (slot < 32));
+	}
+	delete cw;
+
+	// a one-slot window can only choose that slot
+	cw = new ContentionWindow(1, 0.001, true, 512);
+	TEST_ASSERT(cw->chooseSlot(0.5) == 0);
+	delete cw;
+}
+
+void ContentionWindowTest::test_sift_increasing() {
+	const int numSlots = 32;
+	const int numSamples = 100000;
+	int counts[numSlots];
+	for (int i = 0; i < numSlots; i++) counts[i] = 0;
+
+	ContentionWindow* cw = new ContentionWindow(numSlots, 0.001, true, 512);
+	for (int i = 0; i < numSamples; i++) {
+		counts[cw->chooseSlot((i+0.5)/numSamples)]++;
+	}
+	delete cw;
+
+	// later slots are more likely, and the last is N times as likely as
+	// the first
+	TEST_ASSERT(counts[0] < counts[numSlots/2]);
+	TEST_ASSERT(counts[numSlots/2] < counts[numSlots-1]);
+	double alpha = pow(512.0, -1.0/(numSlots-1));
+	double expectedLast = (1-alpha)/(1-pow(alpha, numSlots))*numSamples;
+	TEST_ASSERT(fabs(counts[numSlots-1]-expectedLast) < 0.01*expectedLast);
+}
+
+void ContentionWindowTest::test_slot_start() {
+	ContentionWindow* cw = new ContentionWindow(16, 0.0005, false, 0);
+	TEST_ASSERT(cw->getSlotStart(0) == 0.0);
+	TEST_ASSERT(fabs(cw->getSlotStart(3)-0.0015) < 1e-12);
+	TEST_ASSERT(cw->getNumSlots() == 16);
+	delete cw;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new ContentionWindowTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
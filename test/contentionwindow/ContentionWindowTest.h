@@ -0,0 +1,29 @@
+/*
+ * ContentionWindowTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef CONTENTIONWINDOWTEST_H_
+#define CONTENTIONWINDOWTEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class ContentionWindowTest : public Test::Suite {
+public:
+	ContentionWindowTest();
+
+private:
+	void test_uniform();
+	void test_sift_range();
+	void test_sift_increasing();
+	void test_slot_start();
+
+};
+
+#endif /* CONTENTIONWINDOWTEST_H_ */
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the contention window
+# USAGE: ./testcontentionwindow.sh
+
+# copy contention window files and compile
+make
+
+# run test
+./contentionwindowtest
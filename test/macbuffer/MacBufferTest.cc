@@ -13,6 +13,7 @@ template class MacBuffer<int>;
 MacBufferTest::MacBufferTest() {
 	TEST_ADD(MacBufferTest::test_fifo)
 	TEST_ADD(MacBufferTest::test_capacity)
+	TEST_ADD(MacBufferTest::test_peek_position)
 }
 
 void MacBufferTest::test_fifo() {
@@ -49,6 +50,20 @@ void MacBufferTest::test_capacity() {
 
 }
 
+void MacBufferTest::test_peek_position() {
+  CastaliaModule* cm = new CastaliaModule();
+  MacBuffer<int>* buf = new MacBuffer<int>(cm, 10, true);
+	for (int i=0; i<5; i++) {
+		buf->insertPacket(i*10);
+	}
+	TEST_ASSERT(buf->peek(0) == buf->peek());
+	TEST_ASSERT(buf->peek(1) == 10);
+	TEST_ASSERT(buf->peek(4) == 40);
+	buf->removeFirst();
+	TEST_ASSERT(buf->peek(1) == 20);
+	TEST_ASSERT(buf->numPackets() == 4);
+}
+
 // test program
 int main(int argc, char* argv[]) {
 	Test::Suite ts;
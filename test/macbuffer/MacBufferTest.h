@@ -22,6 +22,7 @@ public:
 private:
 	void test_fifo();
 	void test_capacity();
+	void test_peek_position();
 	//void test_debuf();
 
 };
@@ -0,0 +1,59 @@
+/*
+ * NoiseFloorTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "NoiseFloorTest.h"
+#include "NoiseFloor.h"
+#include <cmath>
+
+NoiseFloorTest::NoiseFloorTest() {
+	TEST_ADD(NoiseFloorTest::test_initial)
+	TEST_ADD(NoiseFloorTest::test_converges)
+	TEST_ADD(NoiseFloorTest::test_median_rejects_spike)
+	TEST_ADD(NoiseFloorTest::test_outlier)
+}
+
+void NoiseFloorTest::test_initial() {
+	NoiseFloor* nf = new NoiseFloor(-95.0, 0.06, 10);
+	TEST_ASSERT(nf->getFloor() == -95.0);
+	nf->addIdleSample(-95.0);
+	TEST_ASSERT(fabs(nf->getFloor()+95.0) < 1e-9);
+	delete nf;
+}
+
+void NoiseFloorTest::test_converges() {
+	NoiseFloor* nf = new NoiseFloor(-90.0, 0.06, 10);
+	for (int i = 0; i < 200; i++)
+		nf->addIdleSample(-100.0);
+	TEST_ASSERT(fabs(nf->getFloor()+100.0) < 0.01);
+	delete nf;
+}
+
+void NoiseFloorTest::test_median_rejects_spike() {
+	NoiseFloor* nf = new NoiseFloor(-100.0, 0.5, 5);
+	for (int i = 0; i < 5; i++)
+		nf->addIdleSample(-100.0);
+	nf->addIdleSample(-60.0);   // taken during a transmission
+	TEST_ASSERT(fabs(nf->getFloor()+100.0) < 1e-9);
+	delete nf;
+}
+
+void NoiseFloorTest::test_outlier() {
+	NoiseFloor* nf = new NoiseFloor(-100.0, 0.06, 10);
+	TEST_ASSERT(nf->isOutlier(-101.0, 0.0));
+	TEST_ASSERT(!nf->isOutlier(-100.0, 0.0));
+	TEST_ASSERT(nf->isOutlier(-100.0, 3.0));
+	TEST_ASSERT(!nf->isOutlier(-90.0, 3.0));
+	delete nf;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new NoiseFloorTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
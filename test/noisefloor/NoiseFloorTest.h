@@ -0,0 +1,29 @@
+/*
+ * NoiseFloorTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef NOISEFLOORTEST_H_
+#define NOISEFLOORTEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class NoiseFloorTest : public Test::Suite {
+public:
+	NoiseFloorTest();
+
+private:
+	void test_initial();
+	void test_converges();
+	void test_median_rejects_spike();
+	void test_outlier();
+
+};
+
+#endif /* NOISEFLOORTEST_H_ */
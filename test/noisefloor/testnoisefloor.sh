@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the noise floor estimate
+# USAGE: ./testnoisefloor.sh
+
+# copy noise floor files and compile
+make
+
+# run test
+./noisefloortest
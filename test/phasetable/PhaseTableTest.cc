@@ -0,0 +1,74 @@
+/*
+ * PhaseTableTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "PhaseTableTest.h"
+#include "PhaseTable.h"
+#include <cmath>
+
+PhaseTableTest::PhaseTableTest() {
+	TEST_ADD(PhaseTableTest::test_unknown)
+	TEST_ADD(PhaseTableTest::test_next_wakeup)
+	TEST_ADD(PhaseTableTest::test_guard_grows)
+	TEST_ADD(PhaseTableTest::test_too_uncertain)
+}
+
+void PhaseTableTest::test_unknown() {
+	PhaseTable* pt = new PhaseTable(0.00003, 0.01);
+	simtime_t wakeup = -1, guard = -1;
+	TEST_ASSERT(!pt->contains(3));
+	TEST_ASSERT(!pt->predict(3, 1.0, wakeup, guard));
+	TEST_ASSERT(wakeup == -1);
+	pt->update(3, 1.2, 0.35, 1.0);
+	TEST_ASSERT(pt->contains(3));
+	TEST_ASSERT(pt->size() == 1);
+	pt->remove(3);
+	TEST_ASSERT(!pt->contains(3));
+	TEST_ASSERT(!pt->predict(3, 1.0, wakeup, guard));
+	delete pt;
+}
+
+void PhaseTableTest::test_next_wakeup() {
+	PhaseTable* pt = new PhaseTable(0, 0.01);
+	simtime_t wakeup, guard;
+	pt->update(3, 1.2, 0.5, 1.0);
+	TEST_ASSERT(pt->predict(3, 1.1, wakeup, guard));
+	TEST_ASSERT(fabs(wakeup-1.2) < 1e-9);
+	TEST_ASSERT(fabs(guard-0.01) < 1e-9);
+	TEST_ASSERT(pt->predict(3, 1.3, wakeup, guard));
+	TEST_ASSERT(fabs(wakeup-1.7) < 1e-9);
+	TEST_ASSERT(pt->predict(3, 11.25, wakeup, guard));
+	TEST_ASSERT(fabs(wakeup-11.7) < 1e-9);
+	delete pt;
+}
+
+void PhaseTableTest::test_guard_grows() {
+	PhaseTable* pt = new PhaseTable(0.00003, 0.01);
+	simtime_t wakeup, guard1, guard2;
+	pt->update(3, 1.0, 0.5, 1.0);
+	TEST_ASSERT(pt->predict(3, 10.9, wakeup, guard1));
+	TEST_ASSERT(pt->predict(3, 100.9, wakeup, guard2));
+	TEST_ASSERT(guard2 > guard1);
+	TEST_ASSERT(fabs(guard2-(0.01+4*0.00003*100)) < 1e-9);
+	delete pt;
+}
+
+void PhaseTableTest::test_too_uncertain() {
+	PhaseTable* pt = new PhaseTable(0.00003, 0.01);
+	simtime_t wakeup, guard;
+	pt->update(3, 1.0, 0.5, 1.0);
+	TEST_ASSERT(pt->predict(3, 1000, wakeup, guard));   // guard 0.13
+	TEST_ASSERT(!pt->predict(3, 2100, wakeup, guard));  // guard 0.262
+	delete pt;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new PhaseTableTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
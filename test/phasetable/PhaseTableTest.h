@@ -0,0 +1,29 @@
+/*
+ * PhaseTableTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef PHASETABLETEST_H_
+#define PHASETABLETEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class PhaseTableTest : public Test::Suite {
+public:
+	PhaseTableTest();
+
+private:
+	void test_unknown();
+	void test_next_wakeup();
+	void test_guard_grows();
+	void test_too_uncertain();
+
+};
+
+#endif /* PHASETABLETEST_H_ */
@@ -0,0 +1,13 @@
+/*
+ * VirtualMac.h
+ *
+ *  Mock of the Castalia header, providing simtime_t for the phase table
+ *  unit test.
+ */
+
+#ifndef VIRTUALMAC_H_
+#define VIRTUALMAC_H_
+
+#include "MockObjects.h"
+
+#endif /* VIRTUALMAC_H_ */
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the phase table
+# USAGE: ./testphasetable.sh
+
+# copy phase table files and compile
+make
+
+# run test
+./phasetabletest
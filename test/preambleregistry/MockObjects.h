@@ -0,0 +1,8 @@
+#ifndef STMOCKOBJECTS_H_
+#define STMOCKOBJECTS_H_
+
+#define simtime_t double
+
+class CastaliaModule {};
+
+#endif    /* STMOCKOBJECTS_H_ */
@@ -0,0 +1,102 @@
+/*
+ * PreambleRegistryTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "PreambleRegistryTest.h"
+#include "PreambleRegistry.h"
+
+PreambleRegistryTest::PreambleRegistryTest() {
+	TEST_ADD(PreambleRegistryTest::test_interval)
+	TEST_ADD(PreambleRegistryTest::test_range)
+	TEST_ADD(PreambleRegistryTest::test_own_preamble)
+	TEST_ADD(PreambleRegistryTest::test_remove_purge)
+	TEST_ADD(PreambleRegistryTest::test_find_preamble_for)
+	TEST_ADD(PreambleRegistryTest::test_clear)
+}
+
+void PreambleRegistryTest::test_interval() {
+	PreambleRegistry* pr = new PreambleRegistry();
+	TEST_ASSERT(!pr->isBusy(2, 0, 0, 0, 50, 1.0));
+	pr->add(1, 9, 0, 0, 0, 1.0, 1.1, 1.101);
+	TEST_ASSERT(!pr->isBusy(2, 0, 0, 0, 50, 0.99));
+	TEST_ASSERT(pr->isBusy(2, 0, 0, 0, 50, 1.0));
+	TEST_ASSERT(pr->isBusy(2, 0, 0, 0, 50, 1.05));
+	TEST_ASSERT(!pr->isBusy(2, 0, 0, 0, 50, 1.1));   // data follows
+	delete pr;
+}
+
+void PreambleRegistryTest::test_range() {
+	PreambleRegistry* pr = new PreambleRegistry();
+	pr->add(1, 9, 10, 10, 0, 1.0, 1.1, 1.101);
+	TEST_ASSERT(pr->isBusy(2, 40, 50, 0, 50, 1.05));    // exactly 50 away
+	TEST_ASSERT(!pr->isBusy(3, 40, 51, 0, 50, 1.05));
+	TEST_ASSERT(!pr->isBusy(4, 10, 10, 60, 50, 1.05));
+	delete pr;
+}
+
+void PreambleRegistryTest::test_own_preamble() {
+	PreambleRegistry* pr = new PreambleRegistry();
+	pr->add(1, 9, 0, 0, 0, 1.0, 1.1, 1.101);
+	TEST_ASSERT(!pr->isBusy(1, 0, 0, 0, 50, 1.05));
+	pr->add(1, 9, 0, 0, 0, 2.0, 2.1, 2.101);   // replaces the first
+	TEST_ASSERT(pr->size() == 1);
+	TEST_ASSERT(!pr->isBusy(2, 0, 0, 0, 50, 1.05));
+	TEST_ASSERT(pr->isBusy(2, 0, 0, 0, 50, 2.05));
+	delete pr;
+}
+
+void PreambleRegistryTest::test_remove_purge() {
+	PreambleRegistry* pr = new PreambleRegistry();
+	pr->add(1, 9, 0, 0, 0, 1.0, 1.1, 1.101);
+	pr->add(2, 9, 0, 0, 0, 1.0, 1.2, 1.201);
+	pr->add(3, 9, 0, 0, 0, 1.0, 1.3, 1.301);
+	pr->remove(2);
+	TEST_ASSERT(pr->size() == 2);
+	pr->purge(1.1);
+	TEST_ASSERT(pr->size() == 1);
+	TEST_ASSERT(pr->isBusy(4, 0, 0, 0, 50, 1.15));
+	pr->add(4, 9, 0, 0, 0, 1.4, 1.5, 1.501);   // adding purges old preambles
+	TEST_ASSERT(pr->size() == 1);
+	delete pr;
+}
+
+void PreambleRegistryTest::test_find_preamble_for() {
+	const int broadcast = -1;
+	PreambleInterval preamble;
+	PreambleRegistry* pr = new PreambleRegistry();
+	pr->add(1, 2, 0, 0, 0, 1.0, 1.1, 1.101);
+	TEST_ASSERT(pr->findPreambleFor(2, 0, 0, 0, 50, 1.05, broadcast, preamble));
+	TEST_ASSERT((preamble.destination == 2) && (preamble.dataTime == 1.101));
+	TEST_ASSERT(!pr->findPreambleFor(3, 0, 0, 0, 50, 1.05, broadcast, preamble));
+	TEST_ASSERT(pr->isBusy(3, 0, 0, 0, 50, 1.05));   // but still overheard
+	TEST_ASSERT(!pr->findPreambleFor(2, 0, 0, 0, 50, 1.2, broadcast, preamble));
+
+	// broadcasts are for everyone; the earliest data is chosen
+	pr->add(4, broadcast, 0, 0, 0, 0.95, 1.05, 1.051);
+	TEST_ASSERT(pr->findPreambleFor(3, 0, 0, 0, 50, 1.0, broadcast, preamble));
+	TEST_ASSERT(preamble.destination == broadcast);
+	TEST_ASSERT(pr->findPreambleFor(2, 0, 0, 0, 50, 1.0, broadcast, preamble));
+	TEST_ASSERT(preamble.dataTime == 1.051);
+	delete pr;
+}
+
+void PreambleRegistryTest::test_clear() {
+	PreambleRegistry* pr = new PreambleRegistry();
+	pr->add(1, 9, 0, 0, 0, 1.0, 2.0, 2.001);
+	pr->add(2, 9, 0, 0, 0, 1.0, 2.0, 2.001);
+	pr->clear();
+	TEST_ASSERT(pr->size() == 0);
+	TEST_ASSERT(!pr->isBusy(3, 0, 0, 0, 50, 1.5));
+	delete pr;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new PreambleRegistryTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
@@ -0,0 +1,31 @@
+/*
+ * PreambleRegistryTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef PREAMBLEREGISTRYTEST_H_
+#define PREAMBLEREGISTRYTEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class PreambleRegistryTest : public Test::Suite {
+public:
+	PreambleRegistryTest();
+
+private:
+	void test_interval();
+	void test_range();
+	void test_own_preamble();
+	void test_remove_purge();
+	void test_find_preamble_for();
+	void test_clear();
+
+};
+
+#endif /* PREAMBLEREGISTRYTEST_H_ */
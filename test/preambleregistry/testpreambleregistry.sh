@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the preamble registry
+# USAGE: ./testpreambleregistry.sh
+
+# copy preamble registry files and compile
+make
+
+# run test
+./preambleregistrytest
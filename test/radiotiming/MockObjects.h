@@ -0,0 +1,8 @@
+#ifndef STMOCKOBJECTS_H_
+#define STMOCKOBJECTS_H_
+
+// the simulator's opp_error stops the simulation; here it throws instead
+class MockOppError {};
+inline void opp_error(const char*, ...) { throw MockOppError(); }
+
+#endif    /* STMOCKOBJECTS_H_ */
@@ -0,0 +1,69 @@
+/*
+ * RadioTimingTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "RadioTimingTest.h"
+#include "RadioTiming.h"
+#include "MockObjects.h"
+#include <cmath>
+
+RadioTimingTest::RadioTimingTest() {
+	TEST_ADD(RadioTimingTest::test_cc2420)
+	TEST_ADD(RadioTimingTest::test_tx_time)
+	TEST_ADD(RadioTimingTest::test_bytes_in_time)
+	TEST_ADD(RadioTimingTest::test_create)
+	TEST_ADD(RadioTimingTest::test_create_unknown)
+}
+
+void RadioTimingTest::test_cc2420() {
+	RadioTiming* rt = RadioTiming::create("CC2420", 19.2, 8, 0.001, 0.002);
+	// 1000 bytes plus 6 of overhead, at 32us per byte
+	TEST_ASSERT(fabs(rt->getTxTime(1000)-0.032192) < 1e-12);
+	TEST_ASSERT(fabs(rt->getTxTime(0)-0.000192) < 1e-12);
+	TEST_ASSERT(fabs(rt->getTurnaroundTime()-0.000192) < 1e-12);
+	TEST_ASSERT(fabs(rt->getWakeupDelay()-0.0005) < 1e-12);
+	delete rt;
+}
+
+void RadioTimingTest::test_tx_time() {
+	RadioTiming* rt = new RadioTiming(250, 6, 0.000192, 0.0005);
+	for (int bytes = 0; bytes < 2000; bytes += 37) {
+		TEST_ASSERT(fabs(rt->getTxTime(bytes)-(6+bytes)*0.000032) < 1e-12);
+	}
+	delete rt;
+}
+
+void RadioTimingTest::test_bytes_in_time() {
+	RadioTiming* rt = new RadioTiming(250, 6, 0.000192, 0.0005);
+	TEST_ASSERT(rt->getBytesInTime(rt->getTxTime(1000)) == 1000);
+	TEST_ASSERT(rt->getBytesInTime(rt->getTxTime(1000)+0.00001) == 1000);
+	TEST_ASSERT(rt->getBytesInTime(0.0001) == 0);   // less than the overhead
+	delete rt;
+}
+
+void RadioTimingTest::test_create() {
+	RadioTiming* rt = RadioTiming::create("CC2420", 19.2, 8, 0.001, 0.002);
+	TEST_ASSERT(rt->getDataRate() == 250);
+	TEST_ASSERT(rt->getFrameOverhead() == 6);
+	delete rt;
+	rt = RadioTiming::create("", 19.2, 8, 0.001, 0.002);
+	TEST_ASSERT(rt->getDataRate() == 19.2);
+	TEST_ASSERT(rt->getWakeupDelay() == 0.002);
+	delete rt;
+}
+
+void RadioTimingTest::test_create_unknown() {
+	TEST_THROWS(RadioTiming::create("CC1000", 19.2, 8, 0.001, 0.002),
+			MockOppError);
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new RadioTimingTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
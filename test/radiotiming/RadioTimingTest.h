@@ -0,0 +1,30 @@
+/*
+ * RadioTimingTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef RADIOTIMINGTEST_H_
+#define RADIOTIMINGTEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class RadioTimingTest : public Test::Suite {
+public:
+	RadioTimingTest();
+
+private:
+	void test_cc2420();
+	void test_tx_time();
+	void test_bytes_in_time();
+	void test_create();
+	void test_create_unknown();
+
+};
+
+#endif /* RADIOTIMINGTEST_H_ */
@@ -0,0 +1,13 @@
+/*
+ * VirtualMac.h
+ *
+ *  Mock of the Castalia header, providing opp_error for the radio timing
+ *  unit test.
+ */
+
+#ifndef VIRTUALMAC_H_
+#define VIRTUALMAC_H_
+
+#include "MockObjects.h"
+
+#endif /* VIRTUALMAC_H_ */
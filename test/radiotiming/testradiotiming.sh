@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the radio timing model
+# USAGE: ./testradiotiming.sh
+
+# copy radio timing files and compile
+make
+
+# run test
+./radiotimingtest
@@ -0,0 +1,158 @@
+/*
+ * ScheduleTableTest.cc
+ *
+ *      Author: mti20
+ */
+
+#include "MockObjects.h"
+#include "ScheduleTableTest.h"
+#include "ScheduleTable.h"
+#include <cmath>
+
+ScheduleTableTest::ScheduleTableTest() {
+	TEST_ADD(ScheduleTableTest::test_extrema)
+	TEST_ADD(ScheduleTableTest::test_overwrite)
+	TEST_ADD(ScheduleTableTest::test_reduce)
+	TEST_ADD(ScheduleTableTest::test_sparse)
+	TEST_ADD(ScheduleTableTest::test_drift)
+	TEST_ADD(ScheduleTableTest::test_windows)
+	TEST_ADD(ScheduleTableTest::test_windows_cache)
+}
+
+void ScheduleTableTest::test_extrema() {
+	ScheduleTable* st = new ScheduleTable();
+	TEST_ASSERT(st->getMaxOffset() == 0.0);
+	TEST_ASSERT(st->getMinOffset() == 0.0);
+	st->update(3, 0.2);
+	st->update(7, 0.5);
+	st->update(9, -0.1);
+	TEST_ASSERT(st->getMaxOffset() == 0.5);
+	TEST_ASSERT(st->getMinOffset() == -0.1);
+	delete st;
+}
+
+void ScheduleTableTest::test_overwrite() {
+	ScheduleTable* st = new ScheduleTable();
+	st->update(7, 0.5);
+	st->update(7, 0.1);   // the old largest value must be forgotten
+	TEST_ASSERT(st->getMaxOffset() == 0.1);
+	TEST_ASSERT(st->getOffset(7) == 0.1);
+	st->update(7, -0.3);
+	TEST_ASSERT(st->getMaxOffset() == 0.0);
+	TEST_ASSERT(st->getMinOffset() == -0.3);
+	delete st;
+}
+
+void ScheduleTableTest::test_reduce() {
+	ScheduleTable* st = new ScheduleTable();
+	st->update(1, 0.75);
+	st->update(2, 0.25);
+	st->reduceAll(0.75);
+	TEST_ASSERT(st->getOffset(1) == 0.0);
+	TEST_ASSERT(st->getOffset(2) == -0.5);
+	TEST_ASSERT(st->getMaxOffset() == 0.0);
+	TEST_ASSERT(st->getMinOffset() == -0.5);
+	st->update(3, 0.25);   // added after the rebase, relative to the new base
+	TEST_ASSERT(st->getOffset(3) == 0.25);
+	TEST_ASSERT(st->getMaxOffset() == 0.25);
+	st->reduceAll(0.25);
+	TEST_ASSERT(st->getOffset(2) == -0.75);
+	TEST_ASSERT(st->getOffset(3) == 0.0);
+	delete st;
+}
+
+void ScheduleTableTest::test_sparse() {
+	ScheduleTable* st = new ScheduleTable();
+	TEST_ASSERT(st->size() == 0);
+	st->update(5000, 0.1);
+	st->update(81, 0.3);
+	st->update(5000, 0.2);
+	TEST_ASSERT(st->size() == 2);
+	TEST_ASSERT(st->contains(81));
+	TEST_ASSERT(!st->contains(32));
+	TEST_ASSERT(st->getOffset(5000) == 0.2);
+	TEST_ASSERT(st->getOffset(32) == 0.0);
+	TEST_ASSERT(st->getMaxOffset() == 0.3);
+	TEST_ASSERT(st->getMinOffset() == 0.0);   // our own schedule
+	delete st;
+}
+
+void ScheduleTableTest::test_drift() {
+	ScheduleTable* st = new ScheduleTable();
+	TEST_ASSERT(st->getMaxDriftRate() == 0.0);
+	st->recordPhase(4, 0.5, 1.0, 10.0);
+	TEST_ASSERT(st->getDriftRate(4) == 0.0);   // one sample isn't enough
+	// 1ms later over 10s, a whole number of frames on
+	st->recordPhase(4, 7.501, 1.0, 20.0);
+	TEST_ASSERT(fabs(st->getDriftRate(4)-0.0001) < 1e-9);
+	// drifting the other way, across a frame boundary
+	st->recordPhase(6, 0.999, 1.0, 10.0);
+	st->recordPhase(6, 3.001, 1.0, 12.0);
+	TEST_ASSERT(fabs(st->getDriftRate(6)-0.001) < 1e-9);
+	st->recordPhase(6, 3.001, 1.0, 14.0);
+	TEST_ASSERT(fabs(st->getDriftRate(6)-0.0005) < 1e-9);   // averaged
+	TEST_ASSERT(fabs(st->getMaxDriftRate()-0.0005) < 1e-9);
+	delete st;
+}
+
+void ScheduleTableTest::test_windows() {
+	ScheduleTable* st = new ScheduleTable();
+	vector<ListenWindow> windows;
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(windows.size() == 1);
+	TEST_ASSERT(windows[0].first == 0.0);
+	TEST_ASSERT(fabs(windows[0].second-0.1) < 1e-9);
+
+	st->update(1, 0.05);    // overlaps our own listen period
+	st->update(2, 0.5);     // another cluster
+	st->update(3, 0.55);
+	st->update(4, -0.05);   // just before us, i.e. at the end of the frame
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(windows.size() == 2);
+	TEST_ASSERT(fabs(windows[0].first+0.05) < 1e-9);
+	TEST_ASSERT(fabs(windows[0].second-0.15) < 1e-9);
+	TEST_ASSERT(fabs(windows[1].first-0.5) < 1e-9);
+	TEST_ASSERT(fabs(windows[1].second-0.65) < 1e-9);
+
+	st->update(5, 0.3);     // a third cluster, followed by fewer neighbours
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(windows.size() == 3);
+	TEST_ASSERT(fabs(windows[1].first-0.3) < 1e-9);
+	st->getListenWindows(0.1, 1.0, 2, windows);
+	TEST_ASSERT(windows.size() == 2);
+	TEST_ASSERT(fabs(windows[1].first-0.5) < 1e-9);
+	st->getListenWindows(0.1, 1.0, 1, windows);
+	TEST_ASSERT(windows.size() == 1);
+	TEST_ASSERT(fabs(windows[0].first+0.05) < 1e-9);
+	delete st;
+}
+
+void ScheduleTableTest::test_windows_cache() {
+	ScheduleTable* st = new ScheduleTable();
+	vector<ListenWindow> windows;
+	st->update(1, 0.5);
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(windows.size() == 2);
+	st->getListenWindows(0.1, 1.0, 3, windows);    // from the cache
+	TEST_ASSERT(windows.size() == 2);
+	TEST_ASSERT(fabs(windows[1].first-0.5) < 1e-9);
+
+	st->update(1, 0.3);     // the cached windows are now out of date
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(fabs(windows[1].first-0.3) < 1e-9);
+	st->reduceAll(0.1);
+	st->getListenWindows(0.1, 1.0, 3, windows);
+	TEST_ASSERT(fabs(windows[1].first-0.2) < 1e-9);
+	st->getListenWindows(0.1, 1.0, 1, windows);    // different parameters
+	TEST_ASSERT(windows.size() == 1);
+	delete st;
+}
+
+// test program
+int main(int argc, char* argv[]) {
+	Test::Suite ts;
+	ts.add(auto_ptr<Test::Suite>(new ScheduleTableTest));
+
+	auto_ptr<Test::Output> output(new Test::TextOutput(Test::TextOutput::Verbose));
+	ts.run(*output, true);
+}
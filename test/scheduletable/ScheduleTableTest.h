@@ -0,0 +1,32 @@
+/*
+ * ScheduleTableTest.h
+ *
+ *      Author: mti20
+ */
+
+#ifndef SCHEDULETABLETEST_H_
+#define SCHEDULETABLETEST_H_
+
+#include "../cpptest/src/cpptest.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+class ScheduleTableTest : public Test::Suite {
+public:
+	ScheduleTableTest();
+
+private:
+	void test_extrema();
+	void test_overwrite();
+	void test_reduce();
+	void test_sparse();
+	void test_drift();
+	void test_windows();
+	void test_windows_cache();
+
+};
+
+#endif /* SCHEDULETABLETEST_H_ */
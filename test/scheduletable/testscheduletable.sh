@@ -0,0 +1,9 @@
+#!/bin/bash
+# Script that runs the tests of the S-MAC schedule table
+# USAGE: ./testscheduletable.sh
+
+# copy schedule table files and compile
+make
+
+# run test
+./scheduletabletest